@@ -26,6 +26,74 @@ void xlink_bitstream_copy_bits(xlink_bitstream *bs, unsigned char *dst,
   }
 }
 
+void xlink_pipe_init(xlink_pipe *pipe) {
+  memset(pipe, 0, sizeof(xlink_pipe));
+  pthread_mutex_init(&pipe->mutex, NULL);
+  pthread_cond_init(&pipe->cond, NULL);
+  xlink_list_init(&pipe->bytes, sizeof(unsigned char), 0);
+}
+
+void xlink_pipe_clear(xlink_pipe *pipe) {
+  pthread_mutex_destroy(&pipe->mutex);
+  pthread_cond_destroy(&pipe->cond);
+  xlink_list_clear(&pipe->bytes);
+}
+
+/* Publish the first bits of bytes, which must not change after this call */
+void xlink_pipe_write(xlink_pipe *pipe, const xlink_list *bytes, int bits,
+ int done) {
+  int length;
+  pthread_mutex_lock(&pipe->mutex);
+  length = (bits + 7)/8;
+  xlink_list_add_all(&pipe->bytes, &bytes->data[pipe->bytes.length],
+   length - pipe->bytes.length);
+  pipe->bits = bits;
+  pipe->done = done;
+  pthread_cond_broadcast(&pipe->cond);
+  pthread_mutex_unlock(&pipe->mutex);
+}
+
+/* Wait until the first bits of the pipe are final, or the pipe is done */
+static void xlink_pipe_lock(xlink_pipe *pipe, int bits) {
+  pthread_mutex_lock(&pipe->mutex);
+  while (pipe->bits < bits && !pipe->done) {
+    pthread_cond_wait(&pipe->cond, &pipe->mutex);
+  }
+}
+
+static void xlink_pipe_unlock(xlink_pipe *pipe) {
+  pthread_mutex_unlock(&pipe->mutex);
+}
+
+#define XLINK_PIPE_CHUNK (256)
+
+/* Run the context model over bytes without coding them, appending the counts
+   for every bit to trace */
+void xlink_context_trace_bytes(xlink_context *ctx, xlink_list *bytes,
+ xlink_list *trace) {
+  int i, j;
+  for (j = 0; j < xlink_list_length(bytes); j++) {
+    unsigned char byte;
+    unsigned char partial;
+    byte = xlink_list_byte(bytes, j);
+    partial = 1;
+    for (i = 8; i-- > 0; ) {
+      unsigned int counts[2];
+      int bit;
+      xlink_context_get_counts(ctx, partial, counts);
+      xlink_list_add(trace, counts);
+      bit = !!(byte & (1 << i));
+      xlink_context_update_bit(ctx, partial, bit);
+      partial <<= 1;
+      partial |= bit;
+    }
+    for (i = 8; i-- > 1; ) {
+      ctx->buf[i] = ctx->buf[i - 1];
+    }
+    ctx->buf[0] = byte;
+  }
+}
+
 #define EC_BITS (31)
 #define EC_BASE (1U << EC_BITS)
 #define EC_HALF (EC_BASE >> 1)
@@ -40,7 +108,7 @@ void xlink_bitstream_copy_bits(xlink_bitstream *bs, unsigned char *dst,
   while (0)
 
 static void xlink_encoder_emit(xlink_encoder *enc, int bit) {
-  XLINK_ERROR(bit == 1 && enc->zero == 0,
+  XLINK_CHECK(bit == 1 && enc->zero == 0,
    ("Got a carry, but have not seen a zero to propogate it into yet"));
   if (bit == 0) {
     if (enc->zero) {
@@ -67,7 +135,7 @@ static void xlink_encoder_emit(xlink_encoder *enc, int bit) {
 static void xlink_encoder_write_bit(xlink_encoder *enc, xlink_word c0,
  xlink_word c1, int bit) {
   xlink_word s;
-  XLINK_ERROR(c0 == 0 || c1 == 0 || (c0 > EC_MASK - c1),
+  XLINK_CHECK(c0 == 0 || c1 == 0 || (c0 > EC_MASK - c1),
    ("Error invalid counts, c0 = %i and c1 = %i", c0, c1));
   s = ((xlink_dword)enc->range)*c1/(c0 + c1);
   enc->range = bit ? s : enc->range - s;
@@ -93,6 +161,8 @@ static void xlink_encoder_write_bit(xlink_encoder *enc, xlink_word c0,
 
 void xlink_encoder_init(xlink_encoder *enc, xlink_context *ctx) {
   enc->ctx = ctx;
+  enc->trace = NULL;
+  enc->pipe = NULL;
   xlink_list_init(&enc->bytes, sizeof(unsigned char), 0);
   enc->bits = 0;
   enc->low = 0;
@@ -101,8 +171,10 @@ void xlink_encoder_init(xlink_encoder *enc, xlink_context *ctx) {
   enc->ones = 0;
   /* Start by writing a 1 bit, this is necessary for decoder implementation */
   xlink_encoder_write_bit(enc, 1, 1, 1);
-  /* Update the context with 1 bit */
-  xlink_context_update_bit(enc->ctx, 0, 1);
+  if (enc->ctx != NULL) {
+    /* Update the context with 1 bit */
+    xlink_context_update_bit(enc->ctx, 0, 1);
+  }
 }
 
 void xlink_encoder_clear(xlink_encoder *enc) {
@@ -114,7 +186,7 @@ void xlink_encoder_write_bytes(xlink_encoder *enc, xlink_list *bytes) {
   for (j = 0; j < xlink_list_length(bytes); j++) {
     unsigned char byte;
     unsigned char partial;
-    byte = *xlink_list_get_byte(bytes, j);
+    byte = xlink_list_byte(bytes, j);
     partial = 1;
     /* Build partially seen byte from high bit to low bit to match decoder. */
     for (i = 8; i-- > 0; ) {
@@ -123,16 +195,42 @@ void xlink_encoder_write_bytes(xlink_encoder *enc, xlink_list *bytes) {
       xlink_context_get_counts(enc->ctx, partial, counts);
       bit = !!(byte & (1 << i));
       xlink_encoder_write_bit(enc, counts[0], counts[1], bit);
+      if (enc->trace != NULL) {
+        xlink_list_add(enc->trace, counts);
+      }
       xlink_context_update_bit(enc->ctx, partial, bit);
       partial <<= 1;
       partial |= bit;
     }
-    XLINK_ERROR(partial != byte,
+    XLINK_CHECK(partial != byte,
      ("Mismatch between partial %02x and byte %02x", partial, byte));
     for (i = 8; i-- > 1; ) {
       enc->ctx->buf[i] = enc->ctx->buf[i - 1];
     }
     enc->ctx->buf[0] = byte;
+    /* Bits already stored are final, the carry only touches pending bits */
+    if (enc->pipe != NULL &&
+     (enc->bits >> 3) - enc->pipe->bytes.length >= XLINK_PIPE_CHUNK) {
+      xlink_pipe_write(enc->pipe, &enc->bytes, enc->bits & ~7, 0);
+    }
+  }
+}
+
+/* Encode bytes with the counts traced by xlink_context_trace_bytes() */
+void xlink_encoder_write_trace(xlink_encoder *enc, xlink_list *bytes,
+ const xlink_list *trace) {
+  int i, j;
+  XLINK_ERROR(xlink_list_length(trace) != 8*xlink_list_length(bytes),
+   ("Trace does not match input bytes, trace = %i and bytes = %i",
+   xlink_list_length(trace), xlink_list_length(bytes)));
+  for (j = 0; j < xlink_list_length(bytes); j++) {
+    unsigned char byte;
+    byte = xlink_list_byte(bytes, j);
+    for (i = 8; i-- > 0; ) {
+      xlink_word *counts;
+      counts = xlink_list_get(trace, 8*j + (7 - i));
+      xlink_encoder_write_bit(enc, counts[0], counts[1], !!(byte & (1 << i)));
+    }
   }
 }
 
@@ -160,29 +258,391 @@ void xlink_encoder_finalize(xlink_encoder *enc, xlink_bitstream *bs) {
   }
   /* Flush any pending bits */
   xlink_encoder_emit(enc, 0);
+  if (enc->pipe != NULL) {
+    xlink_pipe_write(enc->pipe, &enc->bytes, enc->bits, 1);
+  }
   /* Copy finalized bits to bitstream */
   bs->bits = enc->bits;
   bs->bytes.length = 0;
   xlink_list_append(&bs->bytes, &enc->bytes);
 }
 
+typedef struct xlink_eval_match xlink_eval_match;
+
+/* A perfect hashing entry with the counts both with and without clamping */
+struct xlink_eval_match {
+  xlink_match match;
+  unsigned char counts[2][2];
+};
+
+typedef struct xlink_eval xlink_eval;
+
+struct xlink_eval {
+  xlink_config *config;
+  xlink_encoder enc;
+  /* Replacement hashing is a direct mapped table of counts, since an xlink_set
+      with no equals function returns whatever is stored at the hash index */
+  unsigned char (*table)[2];
+  /* The table entry for each model at the current bit */
+  unsigned char *entries[32];
+  xlink_word counts[2];
+};
+
+static void xlink_eval_update(unsigned char counts[2], int clamp, int bit) {
+  if (clamp) {
+    counts[bit] = XLINK_MIN(255, counts[bit] + 1);
+  }
+  else {
+    counts[bit] = counts[bit] + 1;
+  }
+  if (counts[1 - bit] > 1) {
+    counts[1 - bit] >>= 1;
+  }
+}
+
+/* Code one bit with every configuration, computing each model key and hash
+    once.  When encode is 0, only the tables are updated.  Unless history is
+    NULL, it holds the history hashes of each model, recomputed at the first
+    bit of each byte. */
+static void xlink_evaluate_bit(xlink_eval *evals, int nevals,
+ xlink_table *table, xlink_list *models, xlink_match *key, int bit,
+ int encode, unsigned int (*history)[2]) {
+  int i, k;
+  for (k = 0; k < nevals; k++) {
+    evals[k].counts[0] = evals[k].counts[1] = 2;
+  }
+  for (i = 0; i < xlink_list_length(models); i++) {
+    xlink_model *model;
+    xlink_eval_match *match;
+    unsigned int hashes[8];
+    model = xlink_list_get(models, i);
+    key->mask = model->mask;
+    key->salt = model->state;
+    match = xlink_table_get(table, key);
+    hashes[0] = match_hash_code_simple(key);
+    hashes[XLINK_HASH_FAST] = match_hash_code_fast(key);
+    if (history != NULL) {
+      if (key->partial < 2) {
+        history[i][0] = match_hash_history(key, 0);
+        history[i][1] = match_hash_history(key, XLINK_HASH_FAST);
+      }
+      key->salt = history[i][0];
+      hashes[XLINK_HASH_HISTORY] = match_hash_code_history(key);
+      hashes[XLINK_HASH_BUCKET | XLINK_HASH_HISTORY] =
+       match_hash_code_bucket(key);
+      key->salt = history[i][1];
+      hashes[XLINK_HASH_HISTORY | XLINK_HASH_FAST] =
+       match_hash_code_history_fast(key);
+      hashes[XLINK_HASH_BUCKET | XLINK_HASH_HISTORY | XLINK_HASH_FAST] =
+       match_hash_code_bucket_fast(key);
+    }
+    for (k = 0; k < nevals; k++) {
+      xlink_eval *ev;
+      unsigned char *counts;
+      ev = &evals[k];
+      if (ev->config->capacity > 0) {
+        counts = ev->table[hashes[ev->config->hash] % ev->config->capacity];
+        ev->entries[i] = counts;
+      }
+      else if (match != NULL) {
+        counts = match->counts[ev->config->clamp];
+      }
+      else {
+        continue;
+      }
+      ev->counts[0] += ((xlink_word)counts[0]) << model->weight;
+      ev->counts[1] += ((xlink_word)counts[1]) << model->weight;
+    }
+  }
+  for (k = 0; k < nevals; k++) {
+    xlink_eval *ev;
+    ev = &evals[k];
+    if (encode) {
+      xlink_encoder_write_bit(&ev->enc, ev->counts[0], ev->counts[1], bit);
+    }
+    if (ev->config->capacity > 0) {
+      for (i = 0; i < xlink_list_length(models); i++) {
+        xlink_eval_update(ev->entries[i], ev->config->clamp, bit);
+      }
+    }
+  }
+  /* Entries may move when the table grows, so look them up again */
+  for (i = 0; i < xlink_list_length(models); i++) {
+    xlink_model *model;
+    xlink_eval_match *match;
+    model = xlink_list_get(models, i);
+    key->mask = model->mask;
+    key->salt = model->state;
+    match = xlink_table_get(table, key);
+    if (match == NULL) {
+      xlink_eval_match entry;
+      memset(&entry, 0, sizeof(entry));
+      entry.match = *key;
+      match = xlink_table_add(table, &entry);
+    }
+    xlink_eval_update(match->counts[0], 0, bit);
+    xlink_eval_update(match->counts[1], 1, bit);
+  }
+}
+
+/* Compute the exact number of bits each configuration codes the segments in,
+    with one pass over the bytes.  The tables are reset at the start of each
+    segment, while the history carries over as in the packed binary. */
+void xlink_evaluate(xlink_list *configs, xlink_list **models,
+ xlink_list **bytes, int nsegments) {
+  xlink_eval *evals;
+  int nevals;
+  xlink_table table;
+  xlink_match key;
+  xlink_bitstream bs;
+  unsigned int history[32][2];
+  unsigned int (*hashed)[2];
+  int contexts;
+  int i, j, k;
+  nevals = xlink_list_length(configs);
+  evals = xlink_malloc(nevals*sizeof(xlink_eval));
+  hashed = NULL;
+  for (k = 0; k < nevals; k++) {
+    xlink_eval *ev;
+    ev = &evals[k];
+    ev->config = xlink_list_get(configs, k);
+    xlink_encoder_init(&ev->enc, NULL);
+    if (ev->config->capacity > 0) {
+      ev->table = xlink_calloc(ev->config->capacity*sizeof(*ev->table));
+      if (ev->config->hash & XLINK_HASH_HISTORY) {
+        hashed = history;
+      }
+    }
+  }
+  xlink_table_init(&table, match_hash_code_simple, match_equals,
+   sizeof(xlink_eval_match), 1024, 0.75);
+  memset(&key, 0, sizeof(key));
+  contexts = 0;
+  for (j = 0; j < nsegments; j++) {
+    XLINK_ERROR(xlink_list_length(models[j]) > 32,
+     ("Too many models to evaluate, got %i", xlink_list_length(models[j])));
+    if (j == 0) {
+      /* The encoder starts by updating the context with 1 bit */
+      key.partial = 0;
+      xlink_evaluate_bit(evals, nevals, &table, models[j], &key, 1, 0,
+       hashed);
+    }
+    else if (xlink_list_length(bytes[j]) > 0) {
+      xlink_table_reset(&table);
+      for (k = 0; k < nevals; k++) {
+        xlink_eval *ev;
+        ev = &evals[k];
+        if (ev->config->capacity > 0) {
+          xlink_cfree(ev->table, ev->config->capacity*sizeof(*ev->table));
+          ev->table = xlink_calloc(ev->config->capacity*sizeof(*ev->table));
+        }
+      }
+    }
+    for (i = 0; i < xlink_list_length(bytes[j]); i++) {
+      unsigned char byte;
+      int b;
+      byte = xlink_list_byte(bytes[j], i);
+      key.partial = 1;
+      for (b = 8; b-- > 0; ) {
+        int bit;
+        bit = !!(byte & (1 << b));
+        xlink_evaluate_bit(evals, nevals, &table, models[j], &key, bit, 1,
+         hashed);
+        key.partial <<= 1;
+        key.partial |= bit;
+      }
+      for (b = 8; b-- > 1; ) {
+        key.buf[b] = key.buf[b - 1];
+      }
+      key.buf[0] = byte;
+    }
+    contexts = XLINK_MAX(contexts, table.size);
+  }
+  xlink_table_clear(&table);
+  xlink_bitstream_init(&bs);
+  for (k = 0; k < nevals; k++) {
+    xlink_eval *ev;
+    ev = &evals[k];
+    xlink_encoder_finalize(&ev->enc, &bs);
+    ev->config->bits = bs.bits;
+    ev->config->contexts = contexts;
+    xlink_encoder_clear(&ev->enc);
+    if (ev->config->capacity > 0) {
+      xlink_cfree(ev->table, ev->config->capacity*sizeof(*ev->table));
+    }
+  }
+  xlink_bitstream_clear(&bs);
+  free(evals);
+}
+
+static const int XLINK_COST_LINE_BITS[2] = { 4, 5 };
+
+/* Count the instructions the stub decode loop spends on the segments with
+    replacement hashing into capacity entries, which are tagged if tagged is
+    set, where input is the length of the bitstream.  Every bit takes a MUL
+    and a DIV to split the range.  Each model is looked up twice per bit, to
+    load its counts and then to update them, hashing and taking a DIV to index
+    the hash table both times unless speed caches the slot and masks.  With
+    XLINK_HASH_HISTORY in hash, only the partial byte is hashed per bit. */
+void xlink_cost_segments(xlink_cost *cost, xlink_list **models,
+ xlink_list **bytes, int nsegments, int capacity, int hash, int tagged,
+ int speed, int input) {
+  unsigned char *seen[2];
+  int tags[2][XLINK_COST_CACHE >> 4];
+  unsigned int history[32];
+  xlink_match key;
+  int size;
+  int passes;
+  int i, j, k, l;
+  memset(cost, 0, sizeof(xlink_cost));
+  cost->input = input;
+  size = tagged ? 4 : 2;
+  passes = speed ? 1 : 2;
+  if (tagged) {
+    /* The stub clears the tagged entries only once, before the first segment */
+    cost->clears = capacity;
+  }
+  else {
+    /* The stub clears the table before the first segment and after each one */
+    cost->clears = ((double)nsegments + 1)*capacity;
+  }
+  for (l = 0; l < 2; l++) {
+    seen[l] = xlink_calloc(((size*capacity) >> XLINK_COST_LINE_BITS[l]) + 1);
+  }
+  memset(tags, 0xff, sizeof(tags));
+  memset(&key, 0, sizeof(key));
+  for (j = 0; j < nsegments; j++) {
+    XLINK_ERROR(xlink_list_length(models[j]) > 32,
+     ("Too many models to cost, got %i", xlink_list_length(models[j])));
+    if (!tagged || j == 0) {
+      /* Clearing the table leaves none of the lines being looked up cached */
+      memset(tags, 0xff, sizeof(tags));
+    }
+    for (i = 0; i < xlink_list_length(bytes[j]); i++) {
+      unsigned char byte;
+      int b;
+      byte = xlink_list_byte(bytes[j], i);
+      key.partial = 1;
+      for (b = 8; b-- > 0; ) {
+        cost->bits++;
+        cost->muls++;
+        cost->divs++;
+        for (k = 0; k < xlink_list_length(models[j]); k++) {
+          xlink_model *model;
+          unsigned int offset;
+          model = xlink_list_get(models[j], k);
+          key.mask = model->mask;
+          key.salt = model->state;
+          cost->probes++;
+          if (!speed) {
+            cost->divs += 2;
+          }
+          if (hash & XLINK_HASH_HISTORY) {
+            if (b == 7) {
+              history[k] = match_hash_history(&key, hash);
+              cost->hashes += passes*__builtin_popcount(key.mask);
+              cost->steps +=
+               passes*(key.mask == 0 ? 1 : 8 - __builtin_ctz(key.mask));
+            }
+            key.salt = history[k];
+            cost->hashes += passes;
+            cost->steps += passes;
+          }
+          else {
+            cost->hashes += passes*(1 + __builtin_popcount(key.mask));
+            cost->steps +=
+             passes*(key.mask == 0 ? 1 : 9 - __builtin_ctz(key.mask));
+          }
+          offset = XLINK_HASH_CODES[hash](&key);
+          offset = size*(offset % capacity);
+          for (l = 0; l < 2; l++) {
+            int line;
+            int *tag;
+            line = offset >> XLINK_COST_LINE_BITS[l];
+            if (!seen[l][line]) {
+              seen[l][line] = 1;
+              cost->lines[l]++;
+            }
+            tag = &tags[l][line & ((XLINK_COST_CACHE >>
+             XLINK_COST_LINE_BITS[l]) - 1)];
+            if (*tag != line) {
+              *tag = line;
+              cost->misses[l]++;
+            }
+          }
+        }
+        key.partial <<= 1;
+        key.partial |= !!(byte & (1 << b));
+      }
+      for (b = 8; b-- > 1; ) {
+        key.buf[b] = key.buf[b - 1];
+      }
+      key.buf[0] = byte;
+    }
+  }
+  for (l = 0; l < 2; l++) {
+    xlink_cfree(seen[l], ((size*capacity) >> XLINK_COST_LINE_BITS[l]) + 1);
+  }
+}
+
+static unsigned char xlink_reverse_byte(unsigned char byte) {
+  byte = (byte & 0xf0) >> 4 | (byte & 0x0f) << 4;
+  byte = (byte & 0xcc) >> 2 | (byte & 0x33) << 2;
+  return (byte & 0xaa) >> 1 | (byte & 0x55) << 1;
+}
+
+/* Top up the bit window so that at least 57 bits are available.
+   Bits past the end of the bitstream are read as zeros. */
+static void xlink_decoder_fill(xlink_decoder *dec) {
+  if (dec->avail > 56) {
+    return;
+  }
+  if (dec->pipe != NULL) {
+    xlink_pipe_lock(dec->pipe, dec->pos + 64 - dec->avail);
+    dec->bytes = &dec->pipe->bytes;
+    dec->bits = dec->pipe->bits;
+  }
+  while (dec->avail <= 56) {
+    int skip;
+    unsigned char byte;
+    skip = dec->pos & 7;
+    byte = 0;
+    if (dec->pos < dec->bits) {
+      /* Bitstream bytes are stored LSB first, reverse to get stream order */
+      byte = xlink_reverse_byte(dec->bytes->data[dec->pos >> 3]) << skip;
+      if (dec->bits - dec->pos < 8 - skip) {
+        byte &= 0xff00 >> (dec->bits - dec->pos);
+      }
+    }
+    dec->window |= ((xlink_dword)byte) << (56 - dec->avail);
+    dec->avail += 8 - skip;
+    dec->pos += 8 - skip;
+  }
+  if (dec->pipe != NULL) {
+    xlink_pipe_unlock(dec->pipe);
+  }
+}
+
 static int xlink_decoder_read_bit(xlink_decoder *dec, xlink_word c0,
  xlink_word c1) {
   int bit;
   xlink_word s;
-  XLINK_ERROR(c0 == 0 || c1 == 0 || (c0 > EC_MASK - c1),
+  XLINK_CHECK(c0 == 0 || c1 == 0 || (c0 > EC_MASK - c1),
    ("Error invalid counts, c0 = %i and c1 = %i", c0, c1));
   /* Fill value with bits until EC_BASE <= range < 2*EC_BASE */
-  while (dec->range < EC_BASE) {
-    dec->low <<= 1;
-    dec->range <<= 1;
-    dec->value <<= 1;
-    dec->value |=
-     dec->pos >= dec->bits ? 0 : XLINK_GET_BIT(dec->bytes->data, dec->pos);
-    dec->pos++;
+  if (dec->range < EC_BASE) {
+    int shift;
+    shift = __builtin_clz(dec->range);
+    xlink_decoder_fill(dec);
+    dec->low <<= shift;
+    dec->range <<= shift;
+    dec->value <<= shift;
+    dec->value |= (xlink_word)(dec->window >> (64 - shift));
+    dec->window <<= shift;
+    dec->avail -= shift;
   }
   s = ((xlink_dword)dec->range)*c1/(c0 + c1);
-  XLINK_ERROR(s == 0 || s >= dec->range, ("Invalid scale value s = %02x", s));
+  XLINK_CHECK(s == 0 || s >= dec->range, ("Invalid scale value s = %02x", s));
   bit = dec->value < s;
   if (!bit) {
     dec->low += s;
@@ -195,20 +655,39 @@ static int xlink_decoder_read_bit(xlink_decoder *dec, xlink_word c0,
   return bit;
 }
 
-void xlink_decoder_init(xlink_decoder *dec, xlink_context *ctx,
- xlink_bitstream *bs) {
+static void xlink_decoder_start(xlink_decoder *dec, xlink_context *ctx) {
   dec->ctx = ctx;
-  dec->bytes = &bs->bytes;
-  dec->bits = bs->bits;
+  dec->trace = NULL;
+  dec->trace_pos = 0;
   dec->pos = 1;
+  dec->window = 0;
+  dec->avail = 0;
   dec->low = 0;
   dec->range = 1;
   dec->value = 0;
   /* Discard first bit */
   XLINK_ERROR(xlink_decoder_read_bit(dec, 1, 1) == 0,
    ("Expected first decoded bit to be 1"));
-  /* Update the context with 1 bit */
-  xlink_context_update_bit(dec->ctx, 0, 1);
+  if (dec->ctx != NULL) {
+    /* Update the context with 1 bit */
+    xlink_context_update_bit(dec->ctx, 0, 1);
+  }
+}
+
+void xlink_decoder_init(xlink_decoder *dec, xlink_context *ctx,
+ xlink_bitstream *bs) {
+  dec->pipe = NULL;
+  dec->bytes = &bs->bytes;
+  dec->bits = bs->bits;
+  xlink_decoder_start(dec, ctx);
+}
+
+void xlink_decoder_init_pipe(xlink_decoder *dec, xlink_context *ctx,
+ xlink_pipe *pipe) {
+  dec->pipe = pipe;
+  dec->bytes = NULL;
+  dec->bits = 0;
+  xlink_decoder_start(dec, ctx);
 }
 
 void xlink_decoder_clear(xlink_decoder *dec) {
@@ -218,6 +697,17 @@ unsigned char xlink_decoder_read_byte(xlink_decoder *dec) {
   unsigned char byte;
   int i;
   byte = 1;
+  if (dec->ctx == NULL) {
+    XLINK_ERROR(dec->trace == NULL,
+     ("Decoder needs either a context or a trace of counts"));
+    for (i = 8; i-- > 0; ) {
+      xlink_word *counts;
+      counts = xlink_list_get(dec->trace, dec->trace_pos++);
+      byte <<= 1;
+      byte |= xlink_decoder_read_bit(dec, counts[0], counts[1]);
+    }
+    return byte;
+  }
   for (i = 8; i-- > 0; ) {
     unsigned int counts[2];
     int bit;
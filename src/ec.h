@@ -1,6 +1,7 @@
 #ifndef _XLINK_ec_h
 #define _XLINK_ec_h
 
+#include <pthread.h>
 #include <stdint.h>
 #include "paq.h"
 #include "util.h"
@@ -18,13 +19,39 @@ void xlink_bitstream_write_byte(xlink_bitstream *bs, unsigned char byte);
 void xlink_bitstream_copy_bits(xlink_bitstream *bs, unsigned char *dst,
  int pos);
 
+/* Hands finalized bitstream bytes from an encoder to a concurrent decoder */
+typedef struct xlink_pipe xlink_pipe;
+
+struct xlink_pipe {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  xlink_list bytes;
+  int bits;
+  int done;
+};
+
+void xlink_pipe_init(xlink_pipe *pipe);
+void xlink_pipe_clear(xlink_pipe *pipe);
+void xlink_pipe_write(xlink_pipe *pipe, const xlink_list *bytes, int bits,
+ int done);
+
 typedef uint32_t xlink_word;
 typedef uint64_t xlink_dword;
 
+/* The (c0, c1) counts used to code a single bit */
+typedef xlink_word xlink_bit_counts[2];
+
+void xlink_context_trace_bytes(xlink_context *ctx, xlink_list *bytes,
+ xlink_list *trace);
+
 typedef struct xlink_encoder xlink_encoder;
 
 struct xlink_encoder {
   xlink_context *ctx;
+  /* Optional list of xlink_bit_counts, appended for every bit written */
+  xlink_list *trace;
+  /* Optional pipe that finalized bytes are published to while encoding */
+  xlink_pipe *pipe;
   xlink_list bytes;
   int bits;
   xlink_word low;
@@ -36,15 +63,77 @@ struct xlink_encoder {
 void xlink_encoder_init(xlink_encoder *enc, xlink_context *ctx);
 void xlink_encoder_clear(xlink_encoder *enc);
 void xlink_encoder_write_bytes(xlink_encoder *enc, xlink_list *bytes);
+void xlink_encoder_write_trace(xlink_encoder *enc, xlink_list *bytes,
+ const xlink_list *trace);
 void xlink_encoder_finalize(xlink_encoder *enc, xlink_bitstream *bs);
 
+/* A packer configuration whose exact size is found by xlink_evaluate() */
+typedef struct xlink_config xlink_config;
+
+struct xlink_config {
+  /* Replacement hash table words, or 0 for perfect hashing */
+  int capacity;
+  /* Index into XLINK_HASH_CODES */
+  int hash;
+  int clamp;
+  /* Size of the bitstream in bits */
+  int bits;
+  /* Most distinct contexts seen in any one segment */
+  int contexts;
+};
+
+void xlink_evaluate(xlink_list *configs, xlink_list **models,
+ xlink_list **bytes, int nsegments);
+
+/* The work done by the stub to decode the segments, see xlink_cost_segments */
+typedef struct xlink_cost xlink_cost;
+
+/* Size of the data cache simulated for the cache line misses */
+#define XLINK_COST_CACHE (8192)
+
+struct xlink_cost {
+  /* Bits decoded */
+  int bits;
+  /* Bitstream bits shifted into the range coder */
+  int input;
+  /* Model lookups, one for each model at every bit */
+  int probes;
+  /* Bytes combined into a model hash, including the partial byte, when
+     loading and again when updating the counts unless the slot is cached.
+     The history hash combines its bytes only at the first bit of a byte. */
+  int hashes;
+  /* Passes through the loop that walks the history bytes */
+  int steps;
+  int muls;
+  int divs;
+  /* Hash table entries cleared, before and after each EC segment unless
+     tagged */
+  double clears;
+  /* Distinct hash table lines touched with 16 and 32 byte lines */
+  int lines[2];
+  /* Misses in a direct mapped cache of 16 and 32 byte lines */
+  int misses[2];
+};
+
+void xlink_cost_segments(xlink_cost *cost, xlink_list **models,
+ xlink_list **bytes, int nsegments, int capacity, int hash, int tagged,
+ int speed, int input);
+
 typedef struct xlink_decoder xlink_decoder;
 
 struct xlink_decoder {
   xlink_context *ctx;
+  /* When ctx is NULL, decode with the counts recorded in trace instead */
+  const xlink_list *trace;
+  int trace_pos;
+  /* When pipe is not NULL, bytes are read from it as the encoder writes them */
+  xlink_pipe *pipe;
   const xlink_list *bytes;
   int bits;
   int pos;
+  /* Upcoming bits in stream order, most significant bit first */
+  xlink_dword window;
+  int avail;
   xlink_word low;
   xlink_word range;
   xlink_word value;
@@ -52,6 +141,8 @@ struct xlink_decoder {
 
 void xlink_decoder_init(xlink_decoder *dec, xlink_context *ctx,
  xlink_bitstream *bs);
+void xlink_decoder_init_pipe(xlink_decoder *dec, xlink_context *ctx,
+ xlink_pipe *pipe);
 void xlink_decoder_clear(xlink_decoder *dec);
 unsigned char xlink_decoder_read_byte(xlink_decoder *dec);
 
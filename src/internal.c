@@ -1,6 +1,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 #include "internal.h"
 
 void xlink_log(const char *fmt, ...) {
@@ -20,6 +21,43 @@ void *xlink_malloc(size_t size) {
   return ptr;
 }
 
+/* For memory that the caller overwrites before reading */
+void *xlink_malloc_uninit(size_t size) {
+  void *ptr;
+  ptr = malloc(size);
+  XLINK_ERROR(ptr == NULL, ("Insufficient memory for %i byte malloc", size));
+  return ptr;
+}
+
+/* Blocks at least this large are mapped directly from the kernel */
+#define XLINK_CALLOC_MMAP (1 << 20)
+
+/* Zeroed memory that is not touched up front.  Large blocks are anonymous
+   mappings whose pages are only zeroed when they are first accessed.  The
+   memory must be released with xlink_cfree() and the same size. */
+void *xlink_calloc(size_t size) {
+  void *ptr;
+  if (size >= XLINK_CALLOC_MMAP) {
+    ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+     -1, 0);
+    XLINK_ERROR(ptr == MAP_FAILED,
+     ("Insufficient memory for %i byte mapping", size));
+    return ptr;
+  }
+  ptr = calloc(1, size);
+  XLINK_ERROR(ptr == NULL, ("Insufficient memory for %i byte calloc", size));
+  return ptr;
+}
+
+void xlink_cfree(void *ptr, size_t size) {
+  if (size >= XLINK_CALLOC_MMAP) {
+    munmap(ptr, size);
+  }
+  else {
+    free(ptr);
+  }
+}
+
 void *xlink_realloc(void *ptr, size_t size) {
   ptr = realloc(ptr, size);
   XLINK_ERROR(ptr == NULL, ("Insufficient memory for %i byte realloc", size));
@@ -20,7 +20,17 @@ void xlink_log(const char *fmt, ...);
   } \
   while (0)
 
+/* Checks on hot paths that are only compiled into debug builds */
+#if defined(XLINK_DEBUG)
+#define XLINK_CHECK(cond, err) XLINK_ERROR(cond, err)
+#else
+#define XLINK_CHECK(cond, err) do { } while (0)
+#endif
+
 void *xlink_malloc(size_t size);
+void *xlink_malloc_uninit(size_t size);
+void *xlink_calloc(size_t size);
+void xlink_cfree(void *ptr, size_t size);
 void *xlink_realloc(void *ptr, size_t size);
 
 #define XLINK_SET_BIT(buf, i, b) ((buf)[(i) >> 3] = \
@@ -10,7 +10,7 @@ void xlink_file_init(xlink_file *file, const char *name) {
   file->name = name;
   fseek(fp, 0, SEEK_END);
   file->size = ftell(fp);
-  file->buf = xlink_malloc(file->size);
+  file->buf = xlink_malloc_uninit(file->size);
   fseek(fp, 0, SEEK_SET);
   size = fread((unsigned char *)file->buf, 1, file->size, fp);
   XLINK_ERROR(size != file->size,
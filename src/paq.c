@@ -201,37 +201,194 @@ unsigned int match_hash_code_fast(const void *m) {
   return hash;
 }
 
+/* Combine the salt, mask and history of a match, leaving the partial byte to
+    be combined last by match_hash_code_history() */
+unsigned int match_hash_history(const xlink_match *mat, int hash) {
+  unsigned int history;
+  unsigned char byte;
+  int i;
+  /* Use current weight state to salt the hash */
+  history = mat->salt;
+  /* Combine the mask */
+  history = (history & 0xffffff00) | mat->mask;
+  /* Combine the history */
+  for (i = 0; i < 8; i++) {
+    if (mat->mask & (1 << (7 - i))) {
+      byte = (history & 0x000000ff);
+      history = (history & 0xffffff00) | (byte ^ mat->buf[i]);
+      if (hash & XLINK_HASH_FAST) {
+        history = xlink_rotate_left(history, 9);
+      }
+      else {
+        history = ((int)history)*0x6f;
+      }
+      byte = (history & 0x000000ff);
+      history = (history & 0xffffff00) | ((byte + mat->buf[i]) & 0x000000ff);
+      history--;
+    }
+  }
+  return history;
+}
+
+/* The salt is the value of match_hash_history() for the match */
+unsigned int match_hash_code_history(const void *m) {
+  const xlink_match *mat;
+  unsigned int hash;
+  unsigned char byte;
+  mat = (xlink_match *)m;
+  hash = mat->salt;
+  /* Combine the partial */
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | (byte ^ mat->partial);
+  hash = ((int)hash)*0x6f;
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | ((byte + mat->partial) & 0x000000ff);
+  hash--;
+  return hash;
+}
+
+unsigned int match_hash_code_history_fast(const void *m) {
+  const xlink_match *mat;
+  unsigned int hash;
+  unsigned char byte;
+  mat = (xlink_match *)m;
+  hash = mat->salt;
+  /* Combine the partial */
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | (byte ^ mat->partial);
+  hash = xlink_rotate_left(hash, 9);
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | ((byte + mat->partial) & 0x000000ff);
+  hash--;
+  return hash;
+}
+
+/* Split the partial byte into the bits of its nibble decoded so far, with a
+    leading 1, and the slot of the bit in a bucket of 16 entries, so that the
+    4 bits of each nibble share one cache line */
+static unsigned char match_bucket_split(unsigned char partial,
+ unsigned char *slot) {
+  unsigned char bucket;
+  int shift;
+  shift = partial ? (31 - __builtin_clz(partial)) & 3 : 0;
+  bucket = partial >> shift;
+  *slot = partial ^ ((bucket ^ 1) << shift);
+  return bucket;
+}
+
+/* The salt is the value of match_hash_history() for the match, and the slot
+    is in the low 4 bits so that a capacity that is a multiple of 16 keeps
+    each bucket together */
+unsigned int match_hash_code_bucket(const void *m) {
+  const xlink_match *mat;
+  unsigned int hash;
+  unsigned char byte;
+  unsigned char bucket;
+  unsigned char slot;
+  mat = (xlink_match *)m;
+  hash = mat->salt;
+  bucket = match_bucket_split(mat->partial, &slot);
+  /* Combine the bucket */
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | (byte ^ bucket);
+  hash = ((int)hash)*0x6f;
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | ((byte + bucket) & 0x000000ff);
+  hash--;
+  return hash << 4 | slot;
+}
+
+unsigned int match_hash_code_bucket_fast(const void *m) {
+  const xlink_match *mat;
+  unsigned int hash;
+  unsigned char byte;
+  unsigned char bucket;
+  unsigned char slot;
+  mat = (xlink_match *)m;
+  hash = mat->salt;
+  bucket = match_bucket_split(mat->partial, &slot);
+  /* Combine the bucket */
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | (byte ^ bucket);
+  hash = xlink_rotate_left(hash, 9);
+  byte = (hash & 0x000000ff);
+  hash = (hash & 0xffffff00) | ((byte + bucket) & 0x000000ff);
+  hash--;
+  return hash << 4 | slot;
+}
+
+const xlink_hash_code_func XLINK_HASH_CODES[8] = {
+  match_hash_code_simple,
+  match_hash_code_fast,
+  match_hash_code_history,
+  match_hash_code_history_fast,
+  /* Buckets are only hashed after the history */
+  NULL,
+  NULL,
+  match_hash_code_bucket,
+  match_hash_code_bucket_fast
+};
+
 void xlink_context_init(xlink_context *ctx, xlink_list *models, int capacity,
- int fast, int clamp) {
+ int hash, int clamp) {
   ctx->models = models;
+  xlink_table_init(&ctx->table, match_hash_code_simple, match_equals,
+   sizeof(xlink_match), 1024, 0.75);
   xlink_set_init(&ctx->matches, match_hash_code_simple, match_equals,
    sizeof(xlink_match), 0, 0.75);
+  ctx->capacity = 0;
   if (capacity > 0) {
     xlink_context_set_fixed_capacity(ctx, capacity);
   }
-  if (fast) {
-    ctx->matches.hash_code = match_hash_code_fast;
-  }
+  ctx->table.hash_code = XLINK_HASH_CODES[hash];
+  ctx->matches.hash_code = XLINK_HASH_CODES[hash];
+  ctx->hash = hash;
   xlink_context_reset(ctx);
   ctx->clamp = clamp;
 }
 
 void xlink_context_clear(xlink_context *ctx) {
+  xlink_table_clear(&ctx->table);
   xlink_set_clear(&ctx->matches);
 }
 
 void xlink_context_reset(xlink_context *ctx) {
   memset(ctx->buf, 0, sizeof(ctx->buf));
+  xlink_table_reset(&ctx->table);
+  xlink_set_reset(&ctx->matches);
+}
+
+/* Switch to a new set of models, keeping only the history bytes */
+void xlink_context_set_models(xlink_context *ctx, xlink_list *models) {
+  ctx->models = models;
+  xlink_table_reset(&ctx->table);
   xlink_set_reset(&ctx->matches);
 }
 
 void xlink_context_set_fixed_capacity(xlink_context *ctx, int capacity) {
+  ctx->capacity = capacity;
   ctx->matches.equals = NULL;
   ctx->matches.load = 1.f;
   xlink_set_reset(&ctx->matches);
   xlink_set_resize(&ctx->matches, capacity);
 }
 
+static xlink_match *xlink_context_get_match(xlink_context *ctx,
+ xlink_match *key) {
+  if (ctx->capacity > 0) {
+    return xlink_set_get(&ctx->matches, key);
+  }
+  return xlink_table_get(&ctx->table, key);
+}
+
+static xlink_match *xlink_context_add_match(xlink_context *ctx,
+ xlink_match *key) {
+  if (ctx->capacity > 0) {
+    return xlink_set_put(&ctx->matches, key);
+  }
+  return xlink_table_add(&ctx->table, key);
+}
+
 void xlink_context_get_counts(xlink_context *ctx, unsigned char partial,
  unsigned int counts[2]) {
   xlink_match key;
@@ -245,7 +402,14 @@ void xlink_context_get_counts(xlink_context *ctx, unsigned char partial,
     model = xlink_list_get(ctx->models, i);
     key.mask = model->mask;
     key.salt = model->state;
-    match = xlink_set_get(&ctx->matches, &key);
+    if (ctx->hash & XLINK_HASH_HISTORY) {
+      /* Hash the history once at the first bit of each byte */
+      if (partial < 2) {
+        ctx->history[i] = match_hash_history(&key, ctx->hash);
+      }
+      key.salt = ctx->history[i];
+    }
+    match = xlink_context_get_match(ctx, &key);
     if (match != NULL) {
       counts[0] += ((unsigned int)match->counts[0]) << model->weight;
       counts[1] += ((unsigned int)match->counts[1]) << model->weight;
@@ -265,10 +429,17 @@ void xlink_context_update_bit(xlink_context *ctx, unsigned char partial,
     model = xlink_list_get(ctx->models, i);
     key.mask = model->mask;
     key.salt = model->state;
-    match = xlink_set_get(&ctx->matches, &key);
+    if (ctx->hash & XLINK_HASH_HISTORY) {
+      /* Hash the history once at the first bit of each byte */
+      if (partial < 2) {
+        ctx->history[i] = match_hash_history(&key, ctx->hash);
+      }
+      key.salt = ctx->history[i];
+    }
+    match = xlink_context_get_match(ctx, &key);
     if (match == NULL) {
       memset(key.counts, 0, sizeof(key.counts));
-      match = xlink_set_put(&ctx->matches, &key);
+      match = xlink_context_add_match(ctx, &key);
     }
     if (ctx->clamp) {
       match->counts[bit] = XLINK_MIN(255, match->counts[bit] + 1);
@@ -285,27 +456,26 @@ void xlink_context_update_bit(xlink_context *ctx, unsigned char partial,
 void xlink_modeler_init(xlink_modeler *mod, int bytes) {
   xlink_list_init(&mod->bytes, sizeof(unsigned char), bytes);
   xlink_list_init(&mod->counts, sizeof(xlink_counts), 8*bytes);
-  xlink_set_init(&mod->matches, match_hash_code, match_equals,
+  xlink_table_init(&mod->matches, match_hash_code, match_equals,
    sizeof(xlink_match), 256*8*bytes, 0.75);
+  memset(&mod->budget, 0, sizeof(xlink_budget));
 }
 
 void xlink_modeler_clear(xlink_modeler *mod) {
   xlink_list_clear(&mod->bytes);
   xlink_list_clear(&mod->counts);
-  xlink_set_clear(&mod->matches);
+  xlink_table_clear(&mod->matches);
 }
 
 void xlink_modeler_load_binary(xlink_modeler *mod, xlink_list *bytes) {
   unsigned char buf[8];
   int i, j, k;
-  printf("Scanning %i bytes for counts... ", xlink_list_length(bytes));
-  fflush(stdout);
   memset(buf, 0, sizeof(buf));
   for (k = 0; k < xlink_list_length(bytes); k++) {
     unsigned char byte;
     unsigned char partial;
     xlink_match key;
-    byte = *xlink_list_get_byte(bytes, k);
+    byte = xlink_list_byte(bytes, k);
     partial = 1;
     memcpy(key.buf, buf, sizeof(buf));
     for (i = 8; i-- > 0; ) {
@@ -316,12 +486,12 @@ void xlink_modeler_load_binary(xlink_modeler *mod, xlink_list *bytes) {
       for (j = 0; j < 256; j++) {
         xlink_match *match;
         key.mask = j;
-        match = xlink_set_get(&mod->matches, &key);
+        match = xlink_table_get(&mod->matches, &key);
         if (match == NULL) {
           memset(key.counts, 0, sizeof(key.counts));
-          match = xlink_set_put(&mod->matches, &key);
+          match = xlink_table_add(&mod->matches, &key);
         }
-        XLINK_ERROR(match == NULL,
+        XLINK_CHECK(match == NULL,
          ("Null pointer for match, should point to allocated xlink_match"));
         counts[j][0] = match->counts[0];
         counts[j][1] = match->counts[1];
@@ -340,7 +510,18 @@ void xlink_modeler_load_binary(xlink_modeler *mod, xlink_list *bytes) {
     buf[0] = byte;
     xlink_list_add(&mod->bytes, &byte);
   }
-  printf("done\n");
+}
+
+/* A read only view of the first bytes of mod, which must outlive it.  The
+   counts are causal, so they match a modeler loaded with just those bytes. */
+void xlink_modeler_prefix(xlink_modeler *view, const xlink_modeler *mod,
+ int bytes) {
+  XLINK_ERROR(bytes > xlink_list_length(&mod->bytes),
+   ("Prefix of %i bytes is longer than modeler, bytes = %i", bytes,
+   xlink_list_length(&mod->bytes)));
+  *view = *mod;
+  view->bytes.length = bytes;
+  view->counts.length = 8*bytes;
 }
 
 double xlink_modeler_get_entropy(xlink_modeler *mod, xlink_list *models) {
@@ -358,7 +539,7 @@ double xlink_modeler_get_entropy(xlink_modeler *mod, xlink_list *models) {
     entropy = 8*(4 + xlink_list_length(models));
     for (j = 0; j < xlink_list_length(&mod->bytes); j++) {
       unsigned char byte;
-      byte = *xlink_list_get_byte(&mod->bytes, j);
+      byte = xlink_list_byte(&mod->bytes, j);
       for (i = 8; i-- > 0; ) {
         int bit;
         xlink_counts *counts;
@@ -384,6 +565,16 @@ double xlink_modeler_get_entropy(xlink_modeler *mod, xlink_list *models) {
   }
 }
 
+double xlink_modeler_get_cost(xlink_modeler *mod, xlink_list *models) {
+  double entropy;
+  entropy = xlink_modeler_get_entropy(mod, models);
+  if (entropy == DBL_MAX) {
+    return entropy;
+  }
+  return entropy + mod->budget.probe_bits*mod->budget.passes*
+   xlink_list_length(models)*xlink_list_length(&mod->counts)/1000;
+}
+
 void xlink_modeler_print(xlink_modeler *mod, xlink_list *models) {
   if (xlink_list_length(models) > 0) {
     double entropy;
@@ -394,6 +585,10 @@ void xlink_modeler_print(xlink_modeler *mod, xlink_list *models) {
     bytes = ceil(entropy/8);
     printf("Found context: %i model(s), %0.3lf bits, %i bytes\n",
      xlink_list_length(models), entropy, bytes);
+    if (mod->budget.probe_bits > 0 || mod->budget.models > 0) {
+      printf("Unpack cost: %i hash probes\n", mod->budget.passes*
+       xlink_list_length(models)*xlink_list_length(&mod->counts));
+    }
     for (i = 0; i < xlink_list_length(models); i++) {
       xlink_model *model;
       model = xlink_list_get(models, i);
@@ -414,30 +609,53 @@ void xlink_modeler_search(xlink_modeler *mod, xlink_list *models) {
   int contains[256];
   double best;
   int add_index;
+  int swap_index;
   int del_index;
-  printf("Searching for best context... ");
-  fflush(stdout);
   xlink_list_empty(models);
   memset(contains, 0, sizeof(contains));
   best = DBL_MAX;
   do {
-    int i;
+    int full;
+    int i, j;
     xlink_model model;
-    add_index = del_index = -1;
-    /* Try to add a model to the working set */
+    add_index = swap_index = del_index = -1;
+    full = mod->budget.models > 0 &&
+     xlink_list_length(models) >= mod->budget.models;
+    /* Try to add a model to the working set, or when the budget allows no
+        more models, to swap one in for the model at swap_index */
     for (i = 0; i < 256; i++) {
       if (!contains[i]) {
-        double entropy;
+        double cost;
         xlink_model_init(&model, i);
         xlink_list_add(models, &model);
-        entropy = xlink_modeler_get_entropy(mod, models);
-        xlink_list_remove(models, xlink_list_length(models) - 1);
-        if (entropy < best) {
-          best = entropy;
-          add_index = i;
+        if (!full) {
+          cost = xlink_modeler_get_cost(mod, models);
+          if (cost < best) {
+            best = cost;
+            add_index = i;
+          }
+        }
+        else {
+          for (j = 0; j < models->length - 1; j++) {
+            xlink_list_swap(models, j, models->length - 1);
+            models->length--;
+            cost = xlink_modeler_get_cost(mod, models);
+            models->length++;
+            xlink_list_swap(models, models->length - 1, j);
+            if (cost < best) {
+              best = cost;
+              add_index = i;
+              swap_index = j;
+            }
+          }
         }
+        xlink_list_remove(models, xlink_list_length(models) - 1);
       }
     }
+    if (swap_index != -1) {
+      contains[xlink_list_get_model(models, swap_index)->mask] = 0;
+      xlink_list_remove(models, swap_index);
+    }
     if (add_index != -1) {
       xlink_model_init(&model, add_index);
       xlink_list_add(models, &model);
@@ -445,14 +663,14 @@ void xlink_modeler_search(xlink_modeler *mod, xlink_list *models) {
     }
     /* Try to remove a model from the working set */
     for (i = 0; i < models->length; i++) {
-      double entropy;
+      double cost;
       xlink_list_swap(models, i, models->length - 1);
       models->length--;
-      entropy = xlink_modeler_get_entropy(mod, models);
+      cost = xlink_modeler_get_cost(mod, models);
       models->length++;
       xlink_list_swap(models, models->length - 1, i);
-      if (entropy < best) {
-        best = entropy;
+      if (cost < best) {
+        best = cost;
         del_index = i;
       }
     }
@@ -462,7 +680,5 @@ void xlink_modeler_search(xlink_modeler *mod, xlink_list *models) {
     }
   }
   while (add_index != -1 || del_index != -1);
-  printf("done\n");
   xlink_list_sort(models, model_comp);
-  xlink_modeler_print(mod, models);
 }
@@ -32,20 +32,41 @@ int match_equals(const void *a, const void *b);
 unsigned int match_hash_code(const void *m);
 unsigned int match_hash_code_fast(const void *m);
 unsigned int match_hash_code_simple(const void *m);
+unsigned int match_hash_history(const xlink_match *mat, int hash);
+unsigned int match_hash_code_history(const void *m);
+unsigned int match_hash_code_history_fast(const void *m);
+unsigned int match_hash_code_bucket(const void *m);
+unsigned int match_hash_code_bucket_fast(const void *m);
+
+/* Bits selecting the hash function, an index into XLINK_HASH_CODES */
+#define XLINK_HASH_FAST (1)
+#define XLINK_HASH_HISTORY (2)
+#define XLINK_HASH_BUCKET (4)
+
+extern const xlink_hash_code_func XLINK_HASH_CODES[8];
 
 typedef struct xlink_context xlink_context;
 
 struct xlink_context {
   unsigned char buf[8];
   xlink_list *models;
+  /* Perfect hashing, with an entry for every distinct match */
+  xlink_table table;
+  /* Replacement hashing, used instead of table when capacity > 0 */
   xlink_set matches;
+  int capacity;
   int clamp;
+  /* Index into XLINK_HASH_CODES */
+  int hash;
+  /* With XLINK_HASH_HISTORY, the history hash of each model this byte */
+  unsigned int history[32];
 };
 
 void xlink_context_init(xlink_context *ctx, xlink_list *models, int capacity,
- int fast, int clamp);
+ int hash, int clamp);
 void xlink_context_clear(xlink_context *ctx);
 void xlink_context_reset(xlink_context *ctx);
+void xlink_context_set_models(xlink_context *ctx, xlink_list *models);
 void xlink_context_set_fixed_capacity(xlink_context *ctx, int capacity);
 void xlink_context_get_counts(xlink_context *ctx, unsigned char partial,
  unsigned int counts[2]);
@@ -54,18 +75,39 @@ void xlink_context_update_bit(xlink_context *ctx, unsigned char partial,
 
 typedef unsigned char xlink_counts[256][2];
 
+/* The unpack time allowed to the models found by xlink_modeler_search().
+   Each model costs passes hash probes for every decoded bit. */
+typedef struct xlink_budget xlink_budget;
+
+struct xlink_budget {
+  /* Bits charged per 1000 hash probes */
+  double probe_bits;
+  /* Hash probes for each model at every bit, 2 to load the counts and then
+     update them, or 1 when the -S --speed stub caches the slot */
+  int passes;
+  /* Most models to search for, or 0 for no limit */
+  int models;
+};
+
 typedef struct xlink_modeler xlink_modeler;
 
 struct xlink_modeler {
   xlink_list bytes;
   xlink_list counts;
-  xlink_set matches;
+  xlink_table matches;
+  xlink_budget budget;
 };
 
 void xlink_modeler_init(xlink_modeler *mod, int bytes);
 void xlink_modeler_clear(xlink_modeler *mod);
 void xlink_modeler_load_binary(xlink_modeler *mod, xlink_list *bytes);
+void xlink_modeler_prefix(xlink_modeler *view, const xlink_modeler *mod,
+ int bytes);
 double xlink_modeler_get_entropy(xlink_modeler *mod, xlink_list *models);
+/* The entropy plus the bits charged by the budget, minimized by the search */
+double xlink_modeler_get_cost(xlink_modeler *mod, xlink_list *models);
+void xlink_modeler_print(xlink_modeler *mod, xlink_list *models);
+/* Does not print, so that searches can run on separate threads */
 void xlink_modeler_search(xlink_modeler *mod, xlink_list *models);
 
 #endif
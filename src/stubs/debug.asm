@@ -27,7 +27,7 @@ print_string_16bit:
   popa
   ret
 
-SEGMENT _TEXT4 USE16 CLASS=CODE
+SEGMENT _TEXT4 USE32 CLASS=CODE
 
 ; Print a $ terminated string
 ;  (E)SI = pointer string to print
@@ -110,7 +110,7 @@ print_hex32_16bit:
 
 BITS 32
 
-SEGMENT _TEXT1 USE16 CLASS=CODE
+SEGMENT _TEXT1 USE32 CLASS=CODE
 
 ; Print an 8-bit hexadecimal number
 ;  AL = number
@@ -122,7 +122,7 @@ print_hex8_32bit:
   call print_hex4
   ret
 
-SEGMENT _TEXT2 USE16 CLASS=CODE
+SEGMENT _TEXT2 USE32 CLASS=CODE
 
 ; Print a 16-bit hexadecimal number
 ;  AX = number
@@ -134,7 +134,7 @@ print_hex16_32bit:
   call print_hex8_32bit
   ret
 
-SEGMENT _TEXT3 USE16 CLASS=CODE
+SEGMENT _TEXT3 USE32 CLASS=CODE
 
 ; Print a 32-bit hexadecimal number
 ;  EAX = number
@@ -29,6 +29,43 @@
 %define XLINK_STUB_CEIL 0
 %endif
 
+%ifndef XLINK_STUB_TAG
+%define XLINK_STUB_TAG 0
+%endif
+
+%ifndef XLINK_STUB_SPEED
+%define XLINK_STUB_SPEED 0
+%endif
+
+%ifndef XLINK_STUB_HISTORY
+%define XLINK_STUB_HISTORY 0
+%endif
+
+%ifndef XLINK_STUB_BUCKET
+%define XLINK_STUB_BUCKET 0
+%endif
+
+%ifndef XLINK_STUB_TIME
+%define XLINK_STUB_TIME 0
+%endif
+
+%if XLINK_STUB_TAG
+; Each entry is a 16-bit tag followed by the counts
+%define XLINK_STUB_ENTRY 4
+%else
+%define XLINK_STUB_ENTRY 2
+%endif
+
+%if XLINK_STUB_SPEED
+; Bytes before the hash table holding the slot each model found, by ESI
+%define XLINK_STUB_SLOTS 0x40000
+%endif
+
+%if XLINK_STUB_HISTORY
+; Bytes below the heap address holding the history hash of each model, by ESI
+%define XLINK_STUB_HISTORIES 0x40000
+%endif
+
 struc stack
   .edi: resd 1
   .esi: resd 1
@@ -41,6 +78,44 @@ struc stack
   .size:
 endstruc
 
+%if XLINK_STUB_TIME
+; Read the time stamp counter, or the BIOS ticks and PIT count, into EDX:EAX
+%macro XLINK_TIME 0
+  test byte [XLINK_time_tsc], 0x10
+  jz %%pit
+
+  ;rdtsc
+  db 0x0f, 0x31
+  jmp %%done
+
+%%pit:
+  push es
+  mov es, [XLINK_time_bios]
+%%tick:
+  mov edx, [es:0x6c]
+
+  ; Latch and read the count of PIT channel 0
+  mov al, 0
+  out 0x43, al
+  in al, 0x40
+  mov ah, al
+  in al, 0x40
+  xchg al, ah
+
+  ; Read again if the BIOS ticked in between
+  cmp edx, [es:0x6c]
+  jne %%tick
+
+  ; EDX:EAX = 65536*ticks + 65535 - count
+  not ax
+  shl eax, 16
+  shrd eax, edx, 16
+  shr edx, 16
+  pop es
+%%done:
+%endmacro
+%endif
+
 CPU 386
 
 GLOBAL XLINK_STUB_NAME
@@ -51,7 +126,7 @@ EXTERN init_
 %endif
 
 %if XLINK_STUB_PACK
-%if !XLINK_STUB_INIT
+%if !XLINK_STUB_INIT && !XLINK_STUB_TIME
 GLOBAL XLINK_heap_offset
 %endif
 GLOBAL XLINK_header_size
@@ -76,6 +151,45 @@ SEGMENT _MAIN USE32 CLASS=CODE
 
 XLINK_STUB_NAME:
 
+%if XLINK_STUB_TIME
+  pushad
+
+  ; Test for CPUID by toggling the ID flag, a 386 or early 486 has neither
+  pushfd
+  pop eax
+  mov ecx, eax
+  xor eax, 0x200000
+  push eax
+  popfd
+  pushfd
+  pop eax
+  xor eax, ecx
+  jz @time_pit
+
+  ; EDX bit 4 is set when there is a time stamp counter
+  mov eax, 1
+  ;cpuid
+  db 0x0f, 0xa2
+  and dl, 0x10
+  mov [XLINK_time_tsc], dl
+  jnz @time_entry
+
+@time_pit:
+  ; Count PIT channel 0 down by one (mode 2) at the same 18.2 Hz tick rate
+  mov al, 0x34
+  out 0x43, al
+  mov al, 0
+  out 0x40, al
+  out 0x40, al
+
+@time_entry:
+  XLINK_TIME
+  mov [XLINK_time_last], eax
+  mov [XLINK_time_last + 4], edx
+
+  popad
+%endif
+
 %if XLINK_STUB_INIT
   call init_
 %endif
@@ -93,6 +207,18 @@ XLINK_STUB_NAME:
 
   ret
 
+%if XLINK_STUB_TIME
+; Time stamp at the end of the last phase, and the sum of the phases
+XLINK_time_last: dd 0, 0
+XLINK_time_total: dd 0, 0
+; Real mode segment, then selector, of the BIOS data area
+XLINK_time_bios: dw 0x40
+; 0x10 when timing with the time stamp counter
+XLINK_time_tsc: db 0
+; Number of phases printed
+XLINK_time_phase: db 0
+%endif
+
 dpmi_ok:
 
   ASSERT {test bx, 1}, NZ, 'DPMI host missing 32-bit support.'
@@ -236,6 +362,21 @@ SEGMENT _DATA USE32 CLASS=DATA
 _XLINK_heap: dd XLINK_heap_base
 
 %else
+%if XLINK_STUB_TIME
+  test byte [XLINK_time_tsc], 0x10
+  jnz @time_selector
+
+  ; Get a selector for the BIOS data area to read the ticks
+  ;  AX = 0002h
+  ;  BX = real mode segment
+  mov ax, 2
+  mov bx, 0x40
+  int 0x31
+  mov [XLINK_time_bios], ax
+
+@time_selector:
+%endif
+
   ; Set ESI to the start of the EC header (minus models in first EC segment)
   mov esi, ec_segs - 0x9
 
@@ -258,7 +399,11 @@ _XLINK_heap: dd XLINK_heap_base
 
   ; Compute and store the hashtable address relative to ES
   sub eax, ebx
-%if !XLINK_STUB_INIT
+%if XLINK_STUB_HISTORY
+  ; Leave the history hashes below the hashtable
+  add eax, XLINK_STUB_HISTORIES
+%endif
+%if !XLINK_STUB_INIT && !XLINK_STUB_TIME
   ;mov [esi + _XLINK_heap - stub32_end + 0x0], eax
   db 0x89, 0x46
 XLINK_heap_offset: db _XLINK_heap - stub32_end
@@ -287,9 +432,52 @@ XLINK_heap_offset: db _XLINK_heap - stub32_end
   rep stosd
 
   ; Hash table clear routine expects carry to be set
+  ;  The allocated memory is not zeroed, and a stale tag that matched would
+  ;  differ from the encoder, so even the tagged table is cleared here
   stc
   jmp @clear_hash_table
 
+%if XLINK_STUB_BUCKET
+@store_history:
+  pop edi
+  mov [ecx + 4*esi - XLINK_STUB_HISTORIES], eax
+@cached_history:
+  mov eax, [ecx + 4*esi - XLINK_STUB_HISTORIES]
+
+  ; Split the partial byte into the bits of its nibble decoded so far and
+  ;  their slot in a bucket of 16 entries
+  ;  EDX = partial byte
+  ;  ECX = bits of the nibble decoded so far, 0 on the very first pass
+  ;  Setting bit 0 keeps BSR off a zero partial byte, which is undefined
+  movzx edx, byte [edi]
+  mov ecx, edx
+  or cl, 1
+  bsr ecx, ecx
+  and cl, 3
+  shr edx, cl
+
+  ; Hash the bits of the nibble with a leading 1 as the bucket
+  xor al, dl
+%if XLINK_STUB_FAST
+  rol eax, 9
+%else
+  imul eax, 0x6f
+%endif
+  add al, dl
+  dec eax
+
+  ; The slot is the partial byte with the nibble bits replaced by a 1
+  xor dl, 1
+  shl edx, cl
+  xor dl, [edi]
+  shl eax, 4
+  or al, dl
+
+  ; Clear EDX and CF to index the hash table
+  xor edx, edx
+  jmp @clear_hash_table
+%endif
+
 
 
 @done_model:
@@ -398,7 +586,12 @@ XLINK_heap_offset: db _XLINK_heap - stub32_end
   add eax, edi
 
   ; EAX = 0 when we are done with this EC segment
+%if XLINK_STUB_TAG
+  ; Entries tagged by an earlier EC segment read as empty, so skip the clear
+  jz @next_segment
+%else
   jz @clear_hash_table
+%endif
 
   ; Reset the counts (initial value changes adaptation rate)
   push 2
@@ -423,7 +616,34 @@ XLINK_heap_offset: db _XLINK_heap - stub32_end
   ; Load the model
   lodsb
 
+%if XLINK_STUB_SPEED
+  ; EBX <= 0 when updating with the bit just decoded
+  test ebx, ebx
+  jg @hash_model
+
+  ; Reuse the slot found when the counts for the bit were loaded
+  mov edi, [_XLINK_heap]
+  mov edi, [edi + 4*esi]
+  jmp @update_counts
+
+@hash_model:
+%endif
+
+%if XLINK_STUB_HISTORY
+  ; ECX = heap address, above the history hashes
+  mov ecx, [_XLINK_heap]
+
+  ; Hash the history only for the first bit of each byte
+  cmp byte [edi], 2
+  jnc @cached_history
+
+  ; Skip the partial byte, which is hashed last
+  push edi
   mov dl, al
+  jmp @skip_byte
+%else
+  mov dl, al
+%endif
 @hash_byte:
   ; EDI = location of byte we are decoding on first pass
   ; [EDI] = partially decoded byte or previously decoded byte
@@ -441,17 +661,51 @@ XLINK_heap_offset: db _XLINK_heap - stub32_end
   jc @hash_byte
   jnz @skip_byte
 
+%if XLINK_STUB_BUCKET
+  ; Keep the branch after segment done short
+  jmp @store_history
+%elif XLINK_STUB_HISTORY
+  ; ECX = 0 once the partial byte has been hashed
+  jecxz @clear_hash_table
+
+  pop edi
+  mov [ecx + 4*esi - XLINK_STUB_HISTORIES], eax
+@cached_history:
+  mov eax, [ecx + 4*esi - XLINK_STUB_HISTORIES]
+
+  ; Hash the partial byte with DL = 0 to end the loop after it
+  xor ecx, ecx
+  xor edx, edx
+  jmp @hash_byte
+%endif
+
 @clear_hash_table:
 
   ;mov edi, 0
   db 0xbf
 _XLINK_heap: dd 0
+%if XLINK_STUB_SPEED
+  ; Clear the cached slots along with the hash table
+  mov ecx, hash_table_words + XLINK_STUB_SLOTS/XLINK_STUB_ENTRY
+%else
   mov ecx, hash_table_words
+%endif
   jnc @index_hash
 
+%if XLINK_STUB_TAG
+  rep stosd
+
+@next_segment:
+%else
   rep stosw
+%endif
 
+%if XLINK_STUB_TIME
+  ; Does OR AL, [ESI] after timing, to keep the branch below short
+  call @time_phase
+%else
   or al, [esi]
+%endif
   popad
 
   ;TODO need to hardcode this value 8 bytes + n model bytes
@@ -459,10 +713,16 @@ _XLINK_heap: dd 0
   db 0x8D, 0x76
 XLINK_header_size: db 0x9
   ;TODO we can flip this (and all of the weight dwords) if ec_seg - XXX is odd
-  jpo @next_bit
+  ; Short, so that xlink flips the opcode byte after XLINK_header_size, and
+  ;  only 2 bytes in range with t, s, h and d (126 bytes back)
+  jpo short @next_bit
 
 @done_decoding:
 
+%if XLINK_STUB_TIME
+  call @time_total
+%endif
+
   ; [ESP] = 0x10010
   ret
 
@@ -470,17 +730,35 @@ XLINK_header_size: db 0x9
 
 @index_hash:
 
+%if XLINK_STUB_SPEED
+  ; Mask the hash to index the power of two sized hash table
+  and eax, hash_table_words - 1
+
+  ; EAX = computed hash
+  ; EDI = cached slots, followed by the hash table
+  lea eax, [edi + XLINK_STUB_ENTRY*eax + XLINK_STUB_SLOTS + XLINK_STUB_ENTRY-1]
+  mov [edi + 4*esi], eax
+  xchg eax, edi
+%else
   ; Compute the remainder to index the hash table
   div ecx
 
   ; EDX = computed hash
   ; EDI = hash table offset
-  lea edi, [edi + 2*edx + 1]
+  lea edi, [edi + XLINK_STUB_ENTRY*edx + XLINK_STUB_ENTRY - 1]
+%endif
 
-  ;TODO don't recompute EDI and instead just store it
-  ;store edi somewhere indexed by ESI
-  ;mov [ebp + 4*esi], edi
-  ;mov edi, [ebp + 4*esi]
+%if XLINK_STUB_TAG
+  ; Tag with the address of the EC segment header
+  mov eax, [esp + stack.size + stack.esi]
+  cmp [edi - 3], ax
+  je @tag_fine
+
+  ; Take over an entry tagged by an earlier EC segment with zero counts
+  mov [edi - 3], ax
+  and word [edi - 1], 0
+@tag_fine:
+%endif
 
   ; Accumulate weighted counts for model
 
@@ -500,6 +778,7 @@ XLINK_header_size: db 0x9
 
   test ebx, ebx
   jg @skip_update
+@update_counts:
   shr byte [edi + ebx], 1
   jnz @floor_fine
   rcl byte [edi + ebx], 1
@@ -517,6 +796,65 @@ XLINK_header_size: db 0x9
   inc esi
   jmp @next_model
 
+%if XLINK_STUB_TIME
+; Add the time since the last phase to the total
+;  EDX:EAX = time since the last phase
+@time_elapsed:
+  XLINK_TIME
+  sub eax, [XLINK_time_last]
+  sbb edx, [XLINK_time_last + 4]
+  add [XLINK_time_total], eax
+  adc [XLINK_time_total + 4], edx
+  ret
+
+; Print the time taken to clear the hash table, then by each EC segment
+@time_phase:
+  pushad
+  call @time_elapsed
+
+  movzx ecx, byte [XLINK_time_phase]
+  inc byte [XLINK_time_phase]
+  dec ecx
+  jns @time_segment
+
+  PRINT 'Clear       '
+  jmp @time_print
+
+@time_segment:
+  PRINT 'Segment '
+  PRINT8 cl
+  PRINT '  '
+
+@time_print:
+  call @time_count
+  popad
+  or al, [esi]
+  ret
+
+; Print the total time before jumping to the unpacked program
+@time_total:
+  pushad
+  call @time_elapsed
+
+  PRINT 'Total       '
+  mov eax, [XLINK_time_total]
+  mov edx, [XLINK_time_total + 4]
+  call @time_count
+  popad
+  ret
+
+; Print EDX:EAX, then start the next phase after printing
+@time_count:
+  PRINT32 edx
+  PRINT32 eax
+  PRINT {13, 10}
+
+  XLINK_TIME
+  mov [XLINK_time_last], eax
+  mov [XLINK_time_last + 4], edx
+  ret
+%endif
+
 
 stub32_end:
 
@@ -1,4 +0,0 @@
-%define XLINK_STUB_NAME stub32p
-%define XLINK_STUB_PACK 1
-
-%include 'stub32.asm'
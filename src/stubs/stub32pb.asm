@@ -1,5 +0,0 @@
-%define XLINK_STUB_NAME stub32pb
-%define XLINK_STUB_PACK 1
-%define XLINK_STUB_BASE 1
-
-%include 'stub32.asm'
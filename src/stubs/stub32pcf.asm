@@ -1,6 +0,0 @@
-%define XLINK_STUB_NAME stub32pcf
-%define XLINK_STUB_PACK 1
-%define XLINK_STUB_CEIL 1
-%define XLINK_STUB_FAST 1
-
-%include 'stub32.asm'
@@ -1,7 +0,0 @@
-%define XLINK_STUB_NAME stub32pcfb
-%define XLINK_STUB_PACK 1
-%define XLINK_STUB_CEIL 1
-%define XLINK_STUB_FAST 1
-%define XLINK_STUB_BASE 1
-
-%include 'stub32.asm'
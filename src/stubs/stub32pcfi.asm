@@ -1,7 +0,0 @@
-%define XLINK_STUB_NAME stub32pcfi
-%define XLINK_STUB_PACK 1
-%define XLINK_STUB_CEIL 1
-%define XLINK_STUB_FAST 1
-%define XLINK_STUB_INIT 1
-
-%include 'stub32.asm'
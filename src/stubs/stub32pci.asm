@@ -1,6 +0,0 @@
-%define XLINK_STUB_NAME stub32pci
-%define XLINK_STUB_PACK 1
-%define XLINK_STUB_CEIL 1
-%define XLINK_STUB_INIT 1
-
-%include 'stub32.asm'
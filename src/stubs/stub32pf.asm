@@ -1,5 +0,0 @@
-%define XLINK_STUB_NAME stub32pf
-%define XLINK_STUB_PACK 1
-%define XLINK_STUB_FAST 1
-
-%include 'stub32.asm'
@@ -1,5 +0,0 @@
-%define XLINK_STUB_NAME stub32pi
-%define XLINK_STUB_INIT 1
-%define XLINK_STUB_PACK 1
-
-%include 'stub32.asm'
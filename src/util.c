@@ -7,7 +7,8 @@ void xlink_list_init(xlink_list *list, size_t size, int capacity) {
   memset(list, 0, sizeof(xlink_list));
   list->size = size;
   list->capacity = capacity;
-  list->data = xlink_malloc(list->size*list->capacity);
+  /* Elements past the list length are never read, so skip zeroing them */
+  list->data = xlink_malloc_uninit(list->size*list->capacity);
 }
 
 void xlink_list_clear(xlink_list *list) {
@@ -117,7 +118,7 @@ void xlink_set_init(xlink_set *set, xlink_hash_code_func hash_code,
   set->equals = equals;
   set->capacity = XLINK_MAX(4, capacity);
   set->load = load;
-  set->table = xlink_malloc(set->capacity*sizeof(int));
+  set->table = xlink_malloc_uninit(set->capacity*sizeof(int));
   xlink_list_init(&set->entries, sizeof(xlink_entry), capacity);
   xlink_list_init(&set->values, value_size, capacity);
   xlink_set_reset(set);
@@ -186,7 +187,7 @@ void *xlink_set_add(xlink_set *set, const void *value) {
   entry.hash = set->hash_code(value);
   index = xlink_set_index(set, entry.hash);
   entry.down = set->table[index];
-  XLINK_ERROR(
+  XLINK_CHECK(
    xlink_list_length(&set->entries) != xlink_list_length(&set->values),
    ("Invalid xlink_set state, entries length = %i but values length = %i\n",
    xlink_list_length(&set->entries), xlink_list_length(&set->values)));
@@ -268,3 +269,112 @@ void *xlink_set_put(xlink_set *set, void *value) {
   xlink_set_remove(set, value);
   return xlink_set_add(set, value);
 }
+
+#define XLINK_TABLE_TAG(slot) (*(unsigned int *)(slot))
+#define XLINK_TABLE_VALUE(slot) ((slot) + sizeof(unsigned int))
+
+/* Spread the hash over all index bits with Fibonacci hashing */
+static unsigned int xlink_table_index(xlink_table *table, unsigned int tag) {
+  return (tag*0x9e3779b9u) >> (32 - table->bits);
+}
+
+/* Size the table to hold size values before it needs to resize */
+void xlink_table_init(xlink_table *table, xlink_hash_code_func hash_code,
+ xlink_equals_func equals, size_t value_size, int size, float load) {
+  table->hash_code = hash_code;
+  table->equals = equals;
+  table->value_size = value_size;
+  table->slot_size = sizeof(unsigned int) +
+   (value_size + sizeof(unsigned int) - 1)/sizeof(unsigned int)*
+   sizeof(unsigned int);
+  table->load = load;
+  for (table->bits = 2; table->bits < 30; table->bits++) {
+    if (((double)(1 << table->bits))*load >= size) break;
+  }
+  XLINK_ERROR(((double)(1 << table->bits))*load < size,
+   ("Cannot size table for %i values in 30 bits", size));
+  table->capacity = 1 << table->bits;
+  table->size = 0;
+  table->slots = xlink_calloc(table->capacity*table->slot_size);
+}
+
+void xlink_table_clear(xlink_table *table) {
+  xlink_cfree(table->slots, table->capacity*table->slot_size);
+}
+
+void xlink_table_reset(xlink_table *table) {
+  if (table->size > 0) {
+    /* Hand the pages back rather than writing zeros over all of them */
+    xlink_cfree(table->slots, table->capacity*table->slot_size);
+    table->slots = xlink_calloc(table->capacity*table->slot_size);
+    table->size = 0;
+  }
+}
+
+void xlink_table_resize(xlink_table *table, int bits) {
+  unsigned char *slots;
+  int capacity;
+  int i;
+  XLINK_ERROR(bits > 30 || (1 << bits)*table->load < table->size,
+   ("Cannot resize table with %i values to %i bits", table->size, bits));
+  slots = table->slots;
+  capacity = table->capacity;
+  table->bits = bits;
+  table->capacity = 1 << bits;
+  table->slots = xlink_calloc(table->capacity*table->slot_size);
+  /* Reinsert each value using its stored hash */
+  for (i = 0; i < capacity; i++) {
+    unsigned char *slot;
+    slot = &slots[i*table->slot_size];
+    if (XLINK_TABLE_TAG(slot) != 0) {
+      unsigned int index;
+      index = xlink_table_index(table, XLINK_TABLE_TAG(slot));
+      while (XLINK_TABLE_TAG(&table->slots[index*table->slot_size]) != 0) {
+        index = (index + 1) & (table->capacity - 1);
+      }
+      memcpy(&table->slots[index*table->slot_size], slot, table->slot_size);
+    }
+  }
+  xlink_cfree(slots, capacity*table->slot_size);
+}
+
+void *xlink_table_get(xlink_table *table, const void *key) {
+  unsigned int tag;
+  unsigned int index;
+  /* A tag of zero marks an empty slot */
+  tag = table->hash_code(key) | 1;
+  index = xlink_table_index(table, tag);
+  for (;;) {
+    unsigned char *slot;
+    slot = &table->slots[index*table->slot_size];
+    if (XLINK_TABLE_TAG(slot) == 0) {
+      return NULL;
+    }
+    if (XLINK_TABLE_TAG(slot) == tag &&
+     table->equals(key, XLINK_TABLE_VALUE(slot))) {
+      return XLINK_TABLE_VALUE(slot);
+    }
+    index = (index + 1) & (table->capacity - 1);
+  }
+}
+
+/* Add a value that is not already in the table */
+void *xlink_table_add(xlink_table *table, const void *value) {
+  unsigned int tag;
+  unsigned int index;
+  unsigned char *slot;
+  if (table->size + 1 > table->capacity*table->load) {
+    xlink_table_resize(table, table->bits + 1);
+  }
+  tag = table->hash_code(value) | 1;
+  index = xlink_table_index(table, tag);
+  slot = &table->slots[index*table->slot_size];
+  while (XLINK_TABLE_TAG(slot) != 0) {
+    index = (index + 1) & (table->capacity - 1);
+    slot = &table->slots[index*table->slot_size];
+  }
+  XLINK_TABLE_TAG(slot) = tag;
+  memcpy(XLINK_TABLE_VALUE(slot), value, table->value_size);
+  table->size++;
+  return XLINK_TABLE_VALUE(slot);
+}
@@ -36,6 +36,14 @@ void xlink_list_sort(xlink_list *list, int (*cmp)(const void *, const void *));
 
 #define xlink_list_get_byte(list, i) ((unsigned char *)xlink_list_get(list, i))
 
+/* Byte i of a list of bytes for the per-bit coding loops, only checked in the
+    debug build */
+#if defined(XLINK_DEBUG)
+#define xlink_list_byte(list, i) (*xlink_list_get_byte(list, i))
+#else
+#define xlink_list_byte(list, i) ((list)->data[i])
+#endif
+
 typedef struct xlink_entry xlink_entry;
 
 struct xlink_entry {
@@ -69,4 +77,29 @@ int xlink_set_remove(xlink_set *set, const void *key);
 void *xlink_set_get(xlink_set *set, void *key);
 void *xlink_set_put(xlink_set *set, void *value);
 
+/* Open addressing hash table with linear probing and a power of two number
+   of slots.  Each slot stores the hash of its value followed by the value,
+   which must not need more than unsigned int alignment. */
+typedef struct xlink_table xlink_table;
+
+struct xlink_table {
+  xlink_hash_code_func hash_code;
+  xlink_equals_func equals;
+  size_t value_size;
+  size_t slot_size;
+  float load;
+  int bits;
+  int capacity;
+  int size;
+  unsigned char *slots;
+};
+
+void xlink_table_init(xlink_table *table, xlink_hash_code_func hash_code,
+ xlink_equals_func equals, size_t value_size, int size, float load);
+void xlink_table_clear(xlink_table *table);
+void xlink_table_reset(xlink_table *table);
+void xlink_table_resize(xlink_table *table, int bits);
+void *xlink_table_get(xlink_table *table, const void *key);
+void *xlink_table_add(xlink_table *table, const void *value);
+
 #endif
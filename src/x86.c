@@ -0,0 +1,1268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "internal.h"
+#include "x86.h"
+
+#define X86_EAX (0)
+#define X86_ECX (1)
+#define X86_EDX (2)
+#define X86_EBX (3)
+#define X86_ESP (4)
+#define X86_EBP (5)
+#define X86_ESI (6)
+#define X86_EDI (7)
+
+#define X86_CF (0x1)
+#define X86_PF (0x4)
+#define X86_ZF (0x40)
+#define X86_SF (0x80)
+#define X86_DF (0x400)
+#define X86_OF (0x800)
+#define X86_ID (0x200000)
+
+#define X86_MASK(size) ((size) == 4 ? 0xffffffffu : (1u << 8*(size)) - 1)
+#define X86_SIGN(size) (1u << (8*(size) - 1))
+
+/* Linear address of the real to protected mode entry point given by int 2fh,
+   switching modes when it is called */
+#define X86_DPMI_ENTRY (0x400)
+
+void xlink_x86_init(xlink_x86 *cpu, uint32_t size) {
+  memset(cpu, 0, sizeof(xlink_x86));
+  cpu->size = size;
+  cpu->mem = xlink_calloc(size);
+}
+
+void xlink_x86_clear(xlink_x86 *cpu) {
+  xlink_cfree(cpu->mem, cpu->size);
+  memset(cpu, 0, sizeof(xlink_x86));
+}
+
+static void xlink_x86_check(xlink_x86 *cpu, uint32_t addr, int size) {
+  XLINK_ERROR(addr > cpu->size - size,
+   ("Access to %i bytes at linear address %08x outside of memory, "
+   "CS:EIP = %04x:%08x", size, addr, cpu->sregs[XLINK_X86_CS], cpu->eip));
+}
+
+static uint32_t xlink_x86_load(xlink_x86 *cpu, uint32_t addr, int size) {
+  uint32_t value;
+  int i;
+  xlink_x86_check(cpu, addr, size);
+  value = 0;
+  for (i = size; i-- > 0; ) {
+    value = value << 8 | cpu->mem[addr + i];
+  }
+  return value;
+}
+
+static uint32_t xlink_x86_read(xlink_x86 *cpu, uint32_t addr, int size) {
+  cpu->reads++;
+  return xlink_x86_load(cpu, addr, size);
+}
+
+static void xlink_x86_write(xlink_x86 *cpu, uint32_t addr, uint32_t value,
+ int size) {
+  int i;
+  xlink_x86_check(cpu, addr, size);
+  cpu->writes++;
+  for (i = 0; i < size; i++) {
+    cpu->mem[addr + i] = value >> 8*i;
+  }
+}
+
+static uint32_t xlink_x86_fetch(xlink_x86 *cpu, int size) {
+  uint32_t value;
+  value = xlink_x86_load(cpu, cpu->bases[XLINK_X86_CS] + cpu->eip, size);
+  cpu->eip += size;
+  if (!cpu->code32) {
+    cpu->eip &= 0xffff;
+  }
+  return value;
+}
+
+static uint32_t xlink_x86_sign_extend(uint32_t value, int size) {
+  return (value ^ X86_SIGN(size)) - X86_SIGN(size);
+}
+
+static uint32_t xlink_x86_get_reg(xlink_x86 *cpu, int reg, int size) {
+  if (size == 1) {
+    return reg < 4 ? cpu->regs[reg] & 0xff : cpu->regs[reg - 4] >> 8 & 0xff;
+  }
+  return cpu->regs[reg] & X86_MASK(size);
+}
+
+static void xlink_x86_set_reg(xlink_x86 *cpu, int reg, int size,
+ uint32_t value) {
+  if (size == 1) {
+    if (reg < 4) {
+      cpu->regs[reg] = (cpu->regs[reg] & ~0xffu) | (value & 0xff);
+    }
+    else {
+      cpu->regs[reg - 4] = (cpu->regs[reg - 4] & ~0xff00u) |
+       (value & 0xff) << 8;
+    }
+  }
+  else {
+    cpu->regs[reg] = (cpu->regs[reg] & ~X86_MASK(size)) |
+     (value & X86_MASK(size));
+  }
+}
+
+static void xlink_x86_set_flag(xlink_x86 *cpu, uint32_t flag, int set) {
+  if (set) {
+    cpu->flags |= flag;
+  }
+  else {
+    cpu->flags &= ~flag;
+  }
+}
+
+/* Set ZF, SF and PF from a result */
+static void xlink_x86_set_result(xlink_x86 *cpu, uint32_t res, int size) {
+  res &= X86_MASK(size);
+  xlink_x86_set_flag(cpu, X86_ZF, res == 0);
+  xlink_x86_set_flag(cpu, X86_SF, res & X86_SIGN(size));
+  xlink_x86_set_flag(cpu, X86_PF, !(__builtin_popcount(res & 0xff) & 1));
+}
+
+static int xlink_x86_condition(xlink_x86 *cpu, int cc) {
+  int cond;
+  int sf_of;
+  sf_of = !(cpu->flags & X86_SF) != !(cpu->flags & X86_OF);
+  switch (cc >> 1) {
+    case 0 : cond = !!(cpu->flags & X86_OF); break;
+    case 1 : cond = !!(cpu->flags & X86_CF); break;
+    case 2 : cond = !!(cpu->flags & X86_ZF); break;
+    case 3 : cond = !!(cpu->flags & (X86_CF | X86_ZF)); break;
+    case 4 : cond = !!(cpu->flags & X86_SF); break;
+    case 5 : cond = !!(cpu->flags & X86_PF); break;
+    case 6 : cond = sf_of; break;
+    default : cond = sf_of || cpu->flags & X86_ZF; break;
+  }
+  return cond ^ (cc & 1);
+}
+
+/* The eight ALU operations in encoding order: ADD, OR, ADC, SBB, AND, SUB, XOR
+   and CMP */
+static uint32_t xlink_x86_alu(xlink_x86 *cpu, int op, uint32_t a, uint32_t b,
+ int size) {
+  uint32_t mask;
+  uint32_t sign;
+  uint32_t res;
+  uint64_t carry;
+  mask = X86_MASK(size);
+  sign = X86_SIGN(size);
+  a &= mask;
+  b &= mask;
+  carry = 0;
+  switch (op) {
+    case 2 :
+      carry = cpu->flags & X86_CF;
+    case 0 :
+      res = (a + b + carry) & mask;
+      xlink_x86_set_flag(cpu, X86_CF, (uint64_t)a + b + carry > mask);
+      xlink_x86_set_flag(cpu, X86_OF, (a ^ res) & (b ^ res) & sign);
+      break;
+    case 3 :
+      carry = cpu->flags & X86_CF;
+    case 5 :
+    case 7 :
+      res = (a - b - carry) & mask;
+      xlink_x86_set_flag(cpu, X86_CF, (uint64_t)a < b + carry);
+      xlink_x86_set_flag(cpu, X86_OF, (a ^ b) & (a ^ res) & sign);
+      break;
+    default :
+      res = op == 1 ? a | b : op == 4 ? a & b : a ^ b;
+      cpu->flags &= ~(X86_CF | X86_OF);
+      break;
+  }
+  xlink_x86_set_result(cpu, res, size);
+  return res;
+}
+
+/* The eight shift operations in encoding order: ROL, ROR, RCL, RCR, SHL, SHR,
+   SAL and SAR */
+static uint32_t xlink_x86_shift(xlink_x86 *cpu, int op, uint32_t a, int count,
+ int size) {
+  uint32_t mask;
+  uint32_t sign;
+  int bits;
+  int cf;
+  int i;
+  mask = X86_MASK(size);
+  sign = X86_SIGN(size);
+  bits = 8*size;
+  a &= mask;
+  count &= 31;
+  if (count == 0) {
+    return a;
+  }
+  cf = !!(cpu->flags & X86_CF);
+  switch (op) {
+    case 0 :
+    case 1 : {
+      int n;
+      n = count % bits;
+      if (op == 0) {
+        a = (uint32_t)(((uint64_t)a << n | a >> (bits - n)) & mask);
+        cf = a & 1;
+      }
+      else {
+        a = (uint32_t)(((uint64_t)a << (bits - n) | a >> n) & mask);
+        cf = !!(a & sign);
+      }
+      break;
+    }
+    case 2 :
+    case 3 : {
+      for (i = 0; i < count; i++) {
+        int out;
+        if (op == 2) {
+          out = !!(a & sign);
+          a = (a << 1 | cf) & mask;
+        }
+        else {
+          out = a & 1;
+          a = a >> 1 | (cf ? sign : 0);
+        }
+        cf = out;
+      }
+      break;
+    }
+    case 4 :
+    case 6 : {
+      cf = count <= bits && (uint32_t)((uint64_t)a >> (bits - count)) & 1;
+      a = (uint32_t)((uint64_t)a << count & mask);
+      xlink_x86_set_result(cpu, a, size);
+      break;
+    }
+    case 5 : {
+      cf = a >> (count - 1) & 1;
+      a >>= count;
+      xlink_x86_set_result(cpu, a, size);
+      break;
+    }
+    default : {
+      int32_t s;
+      s = (int32_t)xlink_x86_sign_extend(a, size);
+      cf = s >> (count - 1) & 1;
+      a = (uint32_t)(s >> count) & mask;
+      xlink_x86_set_result(cpu, a, size);
+      break;
+    }
+  }
+  xlink_x86_set_flag(cpu, X86_CF, cf);
+  /* OF is only defined for single bit shifts */
+  if (op == 1 || op == 3) {
+    xlink_x86_set_flag(cpu, X86_OF, (a ^ a << 1) & sign);
+  }
+  else if (op == 5) {
+    xlink_x86_set_flag(cpu, X86_OF, a & (sign >> 1) && count == 1);
+  }
+  else if (op != 7) {
+    xlink_x86_set_flag(cpu, X86_OF, !(a & sign) != !cf);
+  }
+  else {
+    cpu->flags &= ~X86_OF;
+  }
+  return a;
+}
+
+static void xlink_x86_push(xlink_x86 *cpu, uint32_t value, int size) {
+  uint32_t sp;
+  if (cpu->stack32) {
+    sp = cpu->regs[X86_ESP] -= size;
+  }
+  else {
+    sp = (cpu->regs[X86_ESP] - size) & 0xffff;
+    xlink_x86_set_reg(cpu, X86_ESP, 2, sp);
+  }
+  xlink_x86_write(cpu, cpu->bases[XLINK_X86_SS] + sp, value, size);
+}
+
+static uint32_t xlink_x86_pop(xlink_x86 *cpu, int size) {
+  uint32_t sp;
+  sp = cpu->regs[X86_ESP];
+  if (cpu->stack32) {
+    cpu->regs[X86_ESP] += size;
+  }
+  else {
+    sp &= 0xffff;
+    xlink_x86_set_reg(cpu, X86_ESP, 2, sp + size);
+  }
+  return xlink_x86_read(cpu, cpu->bases[XLINK_X86_SS] + sp, size);
+}
+
+static void xlink_x86_load_segment(xlink_x86 *cpu, int sreg, uint16_t value) {
+  cpu->sregs[sreg] = value;
+  if (!cpu->protected) {
+    cpu->bases[sreg] = (uint32_t)value << 4;
+  }
+  else {
+    XLINK_ERROR(value >> 3 >= cpu->nselectors,
+     ("Invalid selector %04x loaded at CS:EIP = %04x:%08x", value,
+     cpu->sregs[XLINK_X86_CS], cpu->eip));
+    cpu->bases[sreg] = cpu->selectors[value >> 3].base;
+    if (sreg == XLINK_X86_CS) {
+      cpu->code32 = cpu->selectors[value >> 3].big;
+    }
+  }
+}
+
+void xlink_x86_load_com(xlink_x86 *cpu, const unsigned char *com, int size) {
+  int i;
+  XLINK_ERROR(size > 0xff00, ("COM file too large to load, %i bytes", size));
+  for (i = 0; i < 6; i++) {
+    xlink_x86_load_segment(cpu, i, i < 4 ? XLINK_X86_PSP : 0);
+  }
+  /* Returning to PSP:0 runs int 20h to exit */
+  cpu->mem[(XLINK_X86_PSP << 4) + 0] = 0xcd;
+  cpu->mem[(XLINK_X86_PSP << 4) + 1] = 0x20;
+  memcpy(&cpu->mem[(XLINK_X86_PSP << 4) + 0x100], com, size);
+  cpu->eip = 0x100;
+  cpu->regs[X86_ESP] = 0xfffe;
+  cpu->flags = 0x2;
+  cpu->heap = XLINK_X86_HEAP;
+}
+
+/* Called at the DPMI entry point, return to the caller in protected mode with
+   selectors for the real mode CS, DS, SS and the PSP */
+static void xlink_x86_enter_protected(xlink_x86 *cpu) {
+  uint16_t ip;
+  uint16_t cs;
+  int i;
+  ip = xlink_x86_pop(cpu, 2);
+  cs = xlink_x86_pop(cpu, 2);
+  memset(cpu->selectors, 0, sizeof(cpu->selectors));
+  cpu->selectors[1].base = (uint32_t)cs << 4;
+  cpu->selectors[2].base = cpu->bases[XLINK_X86_DS];
+  cpu->selectors[3].base = cpu->bases[XLINK_X86_SS];
+  cpu->selectors[4].base = XLINK_X86_PSP << 4;
+  cpu->nselectors = 5;
+  cpu->protected = 1;
+  cpu->stack32 = cpu->regs[X86_EAX] & 1;
+  if (cpu->stack32) {
+    cpu->regs[X86_ESP] &= 0xffff;
+  }
+  /* Selectors are in the LDT with RPL 3 */
+  for (i = 1; i < 5; i++) {
+    static const int SREGS[] = {
+      0, XLINK_X86_CS, XLINK_X86_DS, XLINK_X86_SS, XLINK_X86_ES
+    };
+    xlink_x86_load_segment(cpu, SREGS[i], i << 3 | 7);
+  }
+  xlink_x86_load_segment(cpu, XLINK_X86_FS, 0);
+  xlink_x86_load_segment(cpu, XLINK_X86_GS, 0);
+  cpu->eip = ip;
+  cpu->flags &= ~X86_CF;
+}
+
+static void xlink_x86_print(xlink_x86 *cpu, uint32_t addr) {
+  unsigned char c;
+  while ((c = xlink_x86_read(cpu, addr++, 1)) != '$') {
+    putchar(c);
+  }
+}
+
+static void xlink_x86_interrupt(xlink_x86 *cpu, int n) {
+  int ax;
+  ax = cpu->regs[X86_EAX] & 0xffff;
+  switch (n) {
+    case 0x20 : {
+      cpu->exited = 1;
+      cpu->exit_code = 0;
+      return;
+    }
+    case 0x21 : {
+      switch (ax >> 8) {
+        case 0x02 : {
+          putchar(cpu->regs[X86_EDX] & 0xff);
+          return;
+        }
+        case 0x09 : {
+          xlink_x86_print(cpu, cpu->bases[XLINK_X86_DS] +
+           (cpu->regs[X86_EDX] & X86_MASK(cpu->code32 ? 4 : 2)));
+          return;
+        }
+        case 0x4c : {
+          cpu->exited = 1;
+          cpu->exit_code = ax & 0xff;
+          return;
+        }
+      }
+      break;
+    }
+    case 0x2f : {
+      if (ax == 0x1687 && !cpu->protected) {
+        /* DPMI 0.9 host for a 386 with 32-bit support and no private data */
+        xlink_x86_set_reg(cpu, X86_EAX, 2, 0);
+        xlink_x86_set_reg(cpu, X86_EBX, 2, 1);
+        xlink_x86_set_reg(cpu, X86_ECX, 1, 3);
+        xlink_x86_set_reg(cpu, X86_EDX, 2, 0x005a);
+        xlink_x86_set_reg(cpu, X86_ESI, 2, 0);
+        xlink_x86_set_reg(cpu, X86_EDI, 2, X86_DPMI_ENTRY & 0xf);
+        xlink_x86_load_segment(cpu, XLINK_X86_ES, X86_DPMI_ENTRY >> 4);
+        return;
+      }
+      break;
+    }
+    case 0x31 : {
+      int sel;
+      sel = cpu->regs[X86_EBX] & 0xffff;
+      if (!cpu->protected) break;
+      cpu->flags &= ~X86_CF;
+      switch (ax) {
+        case 0x0008 : {
+          /* Segment limits are not checked */
+          XLINK_ERROR(sel >> 3 >= cpu->nselectors,
+           ("Invalid selector %04x for DPMI set segment limit", sel));
+          return;
+        }
+        case 0x0009 : {
+          XLINK_ERROR(sel >> 3 >= cpu->nselectors,
+           ("Invalid selector %04x for DPMI set access rights", sel));
+          cpu->selectors[sel >> 3].big = !!(cpu->regs[X86_ECX] & 0x4000);
+          /* The host reloads CS on return */
+          xlink_x86_load_segment(cpu, XLINK_X86_CS, cpu->sregs[XLINK_X86_CS]);
+          return;
+        }
+        case 0x0501 : {
+          uint32_t size;
+          size = (cpu->regs[X86_EBX] & 0xffff) << 16 |
+           (cpu->regs[X86_ECX] & 0xffff);
+          if (size > cpu->size - cpu->heap) {
+            xlink_x86_set_reg(cpu, X86_EAX, 2, 0x8013);
+            cpu->flags |= X86_CF;
+            return;
+          }
+          xlink_x86_set_reg(cpu, X86_EBX, 2, cpu->heap >> 16);
+          xlink_x86_set_reg(cpu, X86_ECX, 2, cpu->heap);
+          xlink_x86_set_reg(cpu, X86_ESI, 2, cpu->heap >> 16);
+          xlink_x86_set_reg(cpu, X86_EDI, 2, cpu->heap);
+          cpu->heap += (size + 0xfff) & ~0xfffu;
+          return;
+        }
+      }
+      break;
+    }
+  }
+  XLINK_ERROR(1, ("Unsupported int %02xh with AX = %04x at CS:EIP = %04x:%08x",
+   n, ax, cpu->sregs[XLINK_X86_CS], cpu->eip));
+}
+
+typedef struct xlink_x86_prefix xlink_x86_prefix;
+
+struct xlink_x86_prefix {
+  int osize;
+  int asize;
+  /* Segment override, or -1 for the default */
+  int seg;
+  int rep;
+};
+
+typedef struct xlink_x86_modrm xlink_x86_modrm;
+
+struct xlink_x86_modrm {
+  int reg;
+  /* Register for a register operand, or -1 for memory at addr */
+  int rm;
+  uint32_t offset;
+  uint32_t addr;
+};
+
+static void xlink_x86_decode_modrm(xlink_x86 *cpu, xlink_x86_prefix *pfx,
+ xlink_x86_modrm *m) {
+  int byte;
+  int mod;
+  int rm;
+  int seg;
+  uint32_t ea;
+  byte = xlink_x86_fetch(cpu, 1);
+  mod = byte >> 6;
+  m->reg = byte >> 3 & 7;
+  rm = byte & 7;
+  m->rm = -1;
+  if (mod == 3) {
+    m->rm = rm;
+    return;
+  }
+  seg = XLINK_X86_DS;
+  if (pfx->asize == 2) {
+    static const int BASE[] = {
+      X86_EBX, X86_EBX, X86_EBP, X86_EBP, X86_ESI, X86_EDI, X86_EBP, X86_EBX
+    };
+    static const int INDEX[] = { X86_ESI, X86_EDI, X86_ESI, X86_EDI };
+    if (mod == 0 && rm == 6) {
+      ea = xlink_x86_fetch(cpu, 2);
+    }
+    else {
+      ea = cpu->regs[BASE[rm]];
+      if (rm < 4) {
+        ea += cpu->regs[INDEX[rm]];
+      }
+      if (BASE[rm] == X86_EBP) {
+        seg = XLINK_X86_SS;
+      }
+      if (mod == 1) {
+        ea += xlink_x86_sign_extend(xlink_x86_fetch(cpu, 1), 1);
+      }
+      else if (mod == 2) {
+        ea += xlink_x86_fetch(cpu, 2);
+      }
+    }
+    ea &= 0xffff;
+  }
+  else {
+    int base;
+    base = rm;
+    ea = 0;
+    if (rm == 4) {
+      int sib;
+      int index;
+      sib = xlink_x86_fetch(cpu, 1);
+      index = sib >> 3 & 7;
+      base = sib & 7;
+      if (index != X86_ESP) {
+        ea = cpu->regs[index] << (sib >> 6);
+      }
+    }
+    if (base == X86_EBP && mod == 0) {
+      ea += xlink_x86_fetch(cpu, 4);
+    }
+    else {
+      ea += cpu->regs[base];
+      if (base == X86_ESP || base == X86_EBP) {
+        seg = XLINK_X86_SS;
+      }
+    }
+    if (mod == 1) {
+      ea += xlink_x86_sign_extend(xlink_x86_fetch(cpu, 1), 1);
+    }
+    else if (mod == 2) {
+      ea += xlink_x86_fetch(cpu, 4);
+    }
+  }
+  if (pfx->seg != -1) {
+    seg = pfx->seg;
+  }
+  m->offset = ea;
+  m->addr = cpu->bases[seg] + ea;
+}
+
+static uint32_t xlink_x86_get_rm(xlink_x86 *cpu, xlink_x86_modrm *m,
+ int size) {
+  if (m->rm != -1) {
+    return xlink_x86_get_reg(cpu, m->rm, size);
+  }
+  return xlink_x86_read(cpu, m->addr, size);
+}
+
+static void xlink_x86_set_rm(xlink_x86 *cpu, xlink_x86_modrm *m, int size,
+ uint32_t value) {
+  if (m->rm != -1) {
+    xlink_x86_set_reg(cpu, m->rm, size, value);
+  }
+  else {
+    xlink_x86_write(cpu, m->addr, value, size);
+  }
+}
+
+static void xlink_x86_jump(xlink_x86 *cpu, uint32_t eip) {
+  cpu->eip = cpu->code32 ? eip : eip & 0xffff;
+}
+
+/* MUL, IMUL, DIV and IDIV with the accumulator */
+static void xlink_x86_multiply(xlink_x86 *cpu, int op, uint32_t src,
+ int size) {
+  uint64_t a;
+  uint64_t res;
+  int bits;
+  bits = 8*size;
+  a = xlink_x86_get_reg(cpu, X86_EAX, size);
+  if (size == 1) {
+    a = xlink_x86_get_reg(cpu, X86_EAX, 2);
+  }
+  else {
+    a |= (uint64_t)xlink_x86_get_reg(cpu, X86_EDX, size) << bits;
+  }
+  switch (op) {
+    case 4 :
+    case 5 : {
+      int wide;
+      if (op == 4) {
+        res = (uint64_t)(a & X86_MASK(size))*src;
+        wide = res >> bits != 0;
+      }
+      else {
+        int64_t s;
+        s = (int64_t)(int32_t)xlink_x86_sign_extend(a, size)*
+         (int32_t)xlink_x86_sign_extend(src, size);
+        res = (uint64_t)s;
+        wide = s != (int32_t)xlink_x86_sign_extend(s, size);
+      }
+      xlink_x86_set_flag(cpu, X86_CF | X86_OF, wide);
+      break;
+    }
+    default : {
+      uint64_t quot;
+      uint64_t rem;
+      XLINK_ERROR(src == 0, ("Divide by zero at CS:EIP = %04x:%08x",
+       cpu->sregs[XLINK_X86_CS], cpu->eip));
+      if (op == 6) {
+        quot = a/src;
+        rem = a%src;
+        XLINK_ERROR(quot > X86_MASK(size), ("Divide overflow at "
+         "CS:EIP = %04x:%08x", cpu->sregs[XLINK_X86_CS], cpu->eip));
+      }
+      else {
+        int64_t n;
+        int64_t d;
+        n = size == 4 ? (int64_t)a : (int64_t)xlink_x86_sign_extend(a, 2*size);
+        d = (int32_t)xlink_x86_sign_extend(src, size);
+        XLINK_ERROR(n/d != (int32_t)xlink_x86_sign_extend(n/d, size),
+         ("Divide overflow at CS:EIP = %04x:%08x", cpu->sregs[XLINK_X86_CS],
+         cpu->eip));
+        quot = n/d;
+        rem = n%d;
+      }
+      res = (quot & X86_MASK(size)) | (rem & X86_MASK(size)) << bits;
+      break;
+    }
+  }
+  if (size == 1) {
+    xlink_x86_set_reg(cpu, X86_EAX, 2, res);
+  }
+  else {
+    xlink_x86_set_reg(cpu, X86_EAX, size, res);
+    xlink_x86_set_reg(cpu, X86_EDX, size, res >> bits);
+  }
+}
+
+/* STOS, LODS and MOVS, repeated ECX or CX times with a REP prefix */
+static void xlink_x86_string(xlink_x86 *cpu, xlink_x86_prefix *pfx, int op,
+ int size) {
+  uint32_t mask;
+  int step;
+  mask = X86_MASK(pfx->asize);
+  step = cpu->flags & X86_DF ? -size : size;
+  while (!pfx->rep || cpu->regs[X86_ECX] & mask) {
+    uint32_t si;
+    uint32_t di;
+    int seg;
+    si = cpu->regs[X86_ESI] & mask;
+    di = cpu->regs[X86_EDI] & mask;
+    seg = pfx->seg != -1 ? pfx->seg : XLINK_X86_DS;
+    switch (op) {
+      case 0xa4 : {
+        xlink_x86_write(cpu, cpu->bases[XLINK_X86_ES] + di,
+         xlink_x86_read(cpu, cpu->bases[seg] + si, size), size);
+        xlink_x86_set_reg(cpu, X86_ESI, pfx->asize, si + step);
+        xlink_x86_set_reg(cpu, X86_EDI, pfx->asize, di + step);
+        break;
+      }
+      case 0xaa : {
+        xlink_x86_write(cpu, cpu->bases[XLINK_X86_ES] + di,
+         xlink_x86_get_reg(cpu, X86_EAX, size), size);
+        xlink_x86_set_reg(cpu, X86_EDI, pfx->asize, di + step);
+        break;
+      }
+      default : {
+        xlink_x86_set_reg(cpu, X86_EAX, size,
+         xlink_x86_read(cpu, cpu->bases[seg] + si, size));
+        xlink_x86_set_reg(cpu, X86_ESI, pfx->asize, si + step);
+        break;
+      }
+    }
+    if (!pfx->rep) break;
+    xlink_x86_set_reg(cpu, X86_ECX, pfx->asize, cpu->regs[X86_ECX] - 1);
+  }
+}
+
+static void xlink_x86_unsupported(xlink_x86 *cpu, uint32_t eip, int op) {
+  XLINK_ERROR(1, ("Unsupported instruction %02x at CS:EIP = %04x:%08x", op,
+   cpu->sregs[XLINK_X86_CS], eip));
+}
+
+/* Two byte opcodes following 0fh */
+static void xlink_x86_step_0f(xlink_x86 *cpu, xlink_x86_prefix *pfx,
+ uint32_t eip) {
+  xlink_x86_modrm m;
+  int op;
+  op = xlink_x86_fetch(cpu, 1);
+  if (op >= 0x80 && op <= 0x8f) {
+    uint32_t rel;
+    rel = xlink_x86_sign_extend(xlink_x86_fetch(cpu, pfx->osize), pfx->osize);
+    if (xlink_x86_condition(cpu, op & 0xf)) {
+      xlink_x86_jump(cpu, cpu->eip + rel);
+    }
+    return;
+  }
+  if (op >= 0x90 && op <= 0x9f) {
+    xlink_x86_decode_modrm(cpu, pfx, &m);
+    xlink_x86_set_rm(cpu, &m, 1, xlink_x86_condition(cpu, op & 0xf));
+    return;
+  }
+  switch (op) {
+    case 0x31 : {
+      /* The time stamp counter counts instructions */
+      cpu->regs[X86_EAX] = (uint32_t)cpu->instructions;
+      cpu->regs[X86_EDX] = (uint32_t)(cpu->instructions >> 32);
+      return;
+    }
+    case 0xa2 : {
+      /* A Pentium with only the time stamp counter feature */
+      int leaf;
+      leaf = cpu->regs[X86_EAX];
+      cpu->regs[X86_EAX] = leaf == 0 ? 1 : leaf == 1 ? 0x500 : 0;
+      cpu->regs[X86_EBX] = 0;
+      cpu->regs[X86_ECX] = 0;
+      cpu->regs[X86_EDX] = leaf == 1 ? 0x10 : 0;
+      return;
+    }
+    case 0x02 : {
+      uint16_t sel;
+      xlink_x86_decode_modrm(cpu, pfx, &m);
+      sel = xlink_x86_get_rm(cpu, &m, 2);
+      if (!cpu->protected || sel < 8 || sel >> 3 >= cpu->nselectors) {
+        cpu->flags &= ~X86_ZF;
+        return;
+      }
+      /* Present DPL 3 readable code or writable data */
+      xlink_x86_set_reg(cpu, m.reg, pfx->osize,
+       (sel >> 3 == 1 ? 0xfa00 : 0xf200) |
+       (cpu->selectors[sel >> 3].big ? 0x400000 : 0));
+      cpu->flags |= X86_ZF;
+      return;
+    }
+    case 0xa3 :
+    case 0xab :
+    case 0xb3 :
+    case 0xbb : {
+      uint32_t bit;
+      uint32_t value;
+      xlink_x86_decode_modrm(cpu, pfx, &m);
+      bit = xlink_x86_get_reg(cpu, m.reg, pfx->osize);
+      if (m.rm != -1) {
+        bit &= 8*pfx->osize - 1;
+        value = xlink_x86_get_reg(cpu, m.rm, pfx->osize);
+      }
+      else {
+        int32_t offset;
+        /* A memory bit string is addressed by the signed bit offset */
+        offset = (int32_t)xlink_x86_sign_extend(bit, pfx->osize);
+        m.addr += offset >> 3;
+        bit = offset & 7;
+        value = xlink_x86_read(cpu, m.addr, 1);
+        m.rm = -1;
+      }
+      xlink_x86_set_flag(cpu, X86_CF, value >> bit & 1);
+      if (op != 0xa3) {
+        value &= ~(1u << bit);
+        value |= (op == 0xab) << bit;
+        value ^= (op == 0xbb) << bit;
+        xlink_x86_set_rm(cpu, &m, m.rm != -1 ? pfx->osize : 1, value);
+      }
+      return;
+    }
+    case 0xaf : {
+      int64_t res;
+      xlink_x86_decode_modrm(cpu, pfx, &m);
+      res = (int64_t)(int32_t)xlink_x86_sign_extend(
+       xlink_x86_get_reg(cpu, m.reg, pfx->osize), pfx->osize)*
+       (int32_t)xlink_x86_sign_extend(xlink_x86_get_rm(cpu, &m, pfx->osize),
+       pfx->osize);
+      xlink_x86_set_reg(cpu, m.reg, pfx->osize, res);
+      xlink_x86_set_flag(cpu, X86_CF | X86_OF,
+       res != (int32_t)xlink_x86_sign_extend(res, pfx->osize));
+      return;
+    }
+    case 0xbc :
+    case 0xbd : {
+      uint32_t value;
+      int bit;
+      xlink_x86_decode_modrm(cpu, pfx, &m);
+      value = xlink_x86_get_rm(cpu, &m, pfx->osize);
+      /* The destination is undefined for a zero source, so scramble it to
+          fail code that relies on any one processor */
+      xlink_x86_set_flag(cpu, X86_ZF, value == 0);
+      if (value != 0) {
+        bit = op == 0xbc ? __builtin_ctz(value) : 31 - __builtin_clz(value);
+      }
+      else {
+        bit = 0x5a5a5a5a;
+      }
+      xlink_x86_set_reg(cpu, m.reg, pfx->osize, bit);
+      return;
+    }
+    case 0xb6 :
+    case 0xb7 :
+    case 0xbe :
+    case 0xbf : {
+      uint32_t value;
+      int size;
+      size = op & 1 ? 2 : 1;
+      xlink_x86_decode_modrm(cpu, pfx, &m);
+      value = xlink_x86_get_rm(cpu, &m, size);
+      if (op & 8) {
+        value = xlink_x86_sign_extend(value, size);
+      }
+      xlink_x86_set_reg(cpu, m.reg, pfx->osize, value);
+      return;
+    }
+  }
+  xlink_x86_unsupported(cpu, eip, 0x0f00 | op);
+}
+
+static void xlink_x86_step(xlink_x86 *cpu) {
+  xlink_x86_prefix pfx;
+  xlink_x86_modrm m;
+  uint32_t eip;
+  int op;
+  int size;
+  eip = cpu->eip;
+  pfx.osize = pfx.asize = cpu->code32 ? 4 : 2;
+  pfx.seg = -1;
+  pfx.rep = 0;
+  for (;;) {
+    op = xlink_x86_fetch(cpu, 1);
+    if (op == 0x66) {
+      pfx.osize ^= 6;
+    }
+    else if (op == 0x67) {
+      pfx.asize ^= 6;
+    }
+    else if (op == 0xf2 || op == 0xf3) {
+      pfx.rep = op;
+    }
+    else if ((op & 0xe7) == 0x26) {
+      pfx.seg = op >> 3 & 3;
+    }
+    else if (op == 0x64 || op == 0x65) {
+      pfx.seg = op - 0x64 + XLINK_X86_FS;
+    }
+    else {
+      break;
+    }
+  }
+  cpu->instructions++;
+  /* The ALU operations, in every form from 00h to 3fh */
+  if (op < 0x40 && (op & 7) < 6) {
+    uint32_t res;
+    int alu;
+    alu = op >> 3;
+    size = op & 1 ? pfx.osize : 1;
+    if ((op & 7) < 4) {
+      uint32_t a;
+      uint32_t b;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      a = xlink_x86_get_rm(cpu, &m, size);
+      b = xlink_x86_get_reg(cpu, m.reg, size);
+      if (op & 2) {
+        res = xlink_x86_alu(cpu, alu, b, a, size);
+        if (alu != 7) xlink_x86_set_reg(cpu, m.reg, size, res);
+      }
+      else {
+        res = xlink_x86_alu(cpu, alu, a, b, size);
+        if (alu != 7) xlink_x86_set_rm(cpu, &m, size, res);
+      }
+    }
+    else {
+      res = xlink_x86_alu(cpu, alu, xlink_x86_get_reg(cpu, X86_EAX, size),
+       xlink_x86_fetch(cpu, size), size);
+      if (alu != 7) xlink_x86_set_reg(cpu, X86_EAX, size, res);
+    }
+    return;
+  }
+  if (op >= 0x40 && op <= 0x4f) {
+    int cf;
+    cf = cpu->flags & X86_CF;
+    xlink_x86_set_reg(cpu, op & 7, pfx.osize, xlink_x86_alu(cpu,
+     op & 8 ? 5 : 0, xlink_x86_get_reg(cpu, op & 7, pfx.osize), 1,
+     pfx.osize));
+    xlink_x86_set_flag(cpu, X86_CF, cf);
+    return;
+  }
+  if (op >= 0x50 && op <= 0x57) {
+    xlink_x86_push(cpu, xlink_x86_get_reg(cpu, op & 7, pfx.osize), pfx.osize);
+    return;
+  }
+  if (op >= 0x58 && op <= 0x5f) {
+    xlink_x86_set_reg(cpu, op & 7, pfx.osize, xlink_x86_pop(cpu, pfx.osize));
+    return;
+  }
+  if (op >= 0x70 && op <= 0x7f) {
+    uint32_t rel;
+    rel = xlink_x86_sign_extend(xlink_x86_fetch(cpu, 1), 1);
+    if (xlink_x86_condition(cpu, op & 0xf)) {
+      xlink_x86_jump(cpu, cpu->eip + rel);
+    }
+    return;
+  }
+  if (op >= 0x91 && op <= 0x97) {
+    uint32_t tmp;
+    tmp = xlink_x86_get_reg(cpu, X86_EAX, pfx.osize);
+    xlink_x86_set_reg(cpu, X86_EAX, pfx.osize,
+     xlink_x86_get_reg(cpu, op & 7, pfx.osize));
+    xlink_x86_set_reg(cpu, op & 7, pfx.osize, tmp);
+    return;
+  }
+  if (op >= 0xb0 && op <= 0xbf) {
+    size = op & 8 ? pfx.osize : 1;
+    xlink_x86_set_reg(cpu, op & 7, size, xlink_x86_fetch(cpu, size));
+    return;
+  }
+  switch (op) {
+    case 0x06 :
+    case 0x0e :
+    case 0x16 :
+    case 0x1e : {
+      xlink_x86_push(cpu, cpu->sregs[op >> 3], pfx.osize);
+      return;
+    }
+    case 0x07 :
+    case 0x17 :
+    case 0x1f : {
+      xlink_x86_load_segment(cpu, op >> 3, xlink_x86_pop(cpu, pfx.osize));
+      return;
+    }
+    case 0x0f : {
+      xlink_x86_step_0f(cpu, &pfx, eip);
+      return;
+    }
+    case 0x60 : {
+      uint32_t sp;
+      int i;
+      sp = cpu->regs[X86_ESP];
+      for (i = 0; i < 8; i++) {
+        xlink_x86_push(cpu, i == X86_ESP ? sp : cpu->regs[i], pfx.osize);
+      }
+      return;
+    }
+    case 0x61 : {
+      int i;
+      for (i = 8; i-- > 0; ) {
+        uint32_t value;
+        value = xlink_x86_pop(cpu, pfx.osize);
+        if (i != X86_ESP) {
+          xlink_x86_set_reg(cpu, i, pfx.osize, value);
+        }
+      }
+      return;
+    }
+    case 0x68 :
+    case 0x6a : {
+      size = op == 0x6a ? 1 : pfx.osize;
+      xlink_x86_push(cpu,
+       xlink_x86_sign_extend(xlink_x86_fetch(cpu, size), size), pfx.osize);
+      return;
+    }
+    case 0x69 :
+    case 0x6b : {
+      int64_t res;
+      uint32_t imm;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      size = op == 0x6b ? 1 : pfx.osize;
+      imm = xlink_x86_sign_extend(xlink_x86_fetch(cpu, size), size);
+      res = (int64_t)(int32_t)xlink_x86_sign_extend(
+       xlink_x86_get_rm(cpu, &m, pfx.osize), pfx.osize)*
+       (int32_t)xlink_x86_sign_extend(imm, pfx.osize);
+      xlink_x86_set_reg(cpu, m.reg, pfx.osize, res);
+      xlink_x86_set_flag(cpu, X86_CF | X86_OF,
+       res != (int32_t)xlink_x86_sign_extend(res, pfx.osize));
+      return;
+    }
+    case 0x80 :
+    case 0x81 :
+    case 0x83 : {
+      uint32_t res;
+      uint32_t imm;
+      size = op == 0x80 ? 1 : pfx.osize;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      imm = op == 0x81 ? xlink_x86_fetch(cpu, size) :
+       xlink_x86_sign_extend(xlink_x86_fetch(cpu, 1), 1);
+      res = xlink_x86_alu(cpu, m.reg, xlink_x86_get_rm(cpu, &m, size), imm,
+       size);
+      if (m.reg != 7) xlink_x86_set_rm(cpu, &m, size, res);
+      return;
+    }
+    case 0x84 :
+    case 0x85 : {
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_alu(cpu, 4, xlink_x86_get_rm(cpu, &m, size),
+       xlink_x86_get_reg(cpu, m.reg, size), size);
+      return;
+    }
+    case 0x86 :
+    case 0x87 : {
+      uint32_t tmp;
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      tmp = xlink_x86_get_rm(cpu, &m, size);
+      xlink_x86_set_rm(cpu, &m, size, xlink_x86_get_reg(cpu, m.reg, size));
+      xlink_x86_set_reg(cpu, m.reg, size, tmp);
+      return;
+    }
+    case 0x88 :
+    case 0x89 : {
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_set_rm(cpu, &m, size, xlink_x86_get_reg(cpu, m.reg, size));
+      return;
+    }
+    case 0x8a :
+    case 0x8b : {
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_set_reg(cpu, m.reg, size, xlink_x86_get_rm(cpu, &m, size));
+      return;
+    }
+    case 0x8c : {
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_set_rm(cpu, &m, m.rm != -1 ? pfx.osize : 2,
+       cpu->sregs[m.reg]);
+      return;
+    }
+    case 0x8d : {
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_set_reg(cpu, m.reg, pfx.osize, m.offset);
+      return;
+    }
+    case 0x8e : {
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_load_segment(cpu, m.reg, xlink_x86_get_rm(cpu, &m, 2));
+      return;
+    }
+    case 0x8f : {
+      uint32_t value;
+      value = xlink_x86_pop(cpu, pfx.osize);
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_set_rm(cpu, &m, pfx.osize, value);
+      return;
+    }
+    case 0x90 : {
+      return;
+    }
+    case 0x98 : {
+      xlink_x86_set_reg(cpu, X86_EAX, pfx.osize, xlink_x86_sign_extend(
+       xlink_x86_get_reg(cpu, X86_EAX, pfx.osize/2), pfx.osize/2));
+      return;
+    }
+    case 0x99 : {
+      xlink_x86_set_reg(cpu, X86_EDX, pfx.osize,
+       xlink_x86_get_reg(cpu, X86_EAX, pfx.osize) & X86_SIGN(pfx.osize) ?
+       0xffffffffu : 0);
+      return;
+    }
+    case 0x9c : {
+      xlink_x86_push(cpu, cpu->flags, pfx.osize);
+      return;
+    }
+    case 0x9d : {
+      cpu->flags = (xlink_x86_pop(cpu, pfx.osize) & (0xfd5 | X86_ID)) | 0x2;
+      return;
+    }
+    case 0xa0 :
+    case 0xa1 :
+    case 0xa2 :
+    case 0xa3 : {
+      uint32_t addr;
+      size = op & 1 ? pfx.osize : 1;
+      addr = cpu->bases[pfx.seg != -1 ? pfx.seg : XLINK_X86_DS] +
+       xlink_x86_fetch(cpu, pfx.asize);
+      if (op & 2) {
+        xlink_x86_write(cpu, addr, xlink_x86_get_reg(cpu, X86_EAX, size),
+         size);
+      }
+      else {
+        xlink_x86_set_reg(cpu, X86_EAX, size, xlink_x86_read(cpu, addr, size));
+      }
+      return;
+    }
+    case 0xa8 :
+    case 0xa9 : {
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_alu(cpu, 4, xlink_x86_get_reg(cpu, X86_EAX, size),
+       xlink_x86_fetch(cpu, size), size);
+      return;
+    }
+    case 0xa4 :
+    case 0xa5 :
+    case 0xaa :
+    case 0xab :
+    case 0xac :
+    case 0xad : {
+      xlink_x86_string(cpu, &pfx, op & ~1, op & 1 ? pfx.osize : 1);
+      return;
+    }
+    case 0xc0 :
+    case 0xc1 :
+    case 0xd0 :
+    case 0xd1 :
+    case 0xd2 :
+    case 0xd3 : {
+      int count;
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      if (op < 0xd0) {
+        count = xlink_x86_fetch(cpu, 1);
+      }
+      else {
+        count = op < 0xd2 ? 1 : cpu->regs[X86_ECX] & 0xff;
+      }
+      xlink_x86_set_rm(cpu, &m, size, xlink_x86_shift(cpu, m.reg,
+       xlink_x86_get_rm(cpu, &m, size), count, size));
+      return;
+    }
+    case 0xc2 :
+    case 0xc3 : {
+      uint32_t ret;
+      uint32_t n;
+      n = op == 0xc2 ? xlink_x86_fetch(cpu, 2) : 0;
+      ret = xlink_x86_pop(cpu, pfx.osize);
+      xlink_x86_jump(cpu, ret);
+      cpu->regs[X86_ESP] += n;
+      return;
+    }
+    case 0xc6 :
+    case 0xc7 : {
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      xlink_x86_set_rm(cpu, &m, size, xlink_x86_fetch(cpu, size));
+      return;
+    }
+    case 0xcd : {
+      xlink_x86_interrupt(cpu, xlink_x86_fetch(cpu, 1));
+      return;
+    }
+    case 0xe2 :
+    case 0xe3 : {
+      uint32_t rel;
+      uint32_t count;
+      rel = xlink_x86_sign_extend(xlink_x86_fetch(cpu, 1), 1);
+      count = xlink_x86_get_reg(cpu, X86_ECX, pfx.asize);
+      if (op == 0xe2) {
+        xlink_x86_set_reg(cpu, X86_ECX, pfx.asize, --count);
+      }
+      if ((count != 0) == (op == 0xe2)) {
+        xlink_x86_jump(cpu, cpu->eip + rel);
+      }
+      return;
+    }
+    case 0xe8 : {
+      uint32_t rel;
+      rel = xlink_x86_sign_extend(xlink_x86_fetch(cpu, pfx.osize), pfx.osize);
+      xlink_x86_push(cpu, cpu->eip, pfx.osize);
+      xlink_x86_jump(cpu, cpu->eip + rel);
+      return;
+    }
+    case 0xe9 :
+    case 0xeb : {
+      uint32_t rel;
+      size = op == 0xeb ? 1 : pfx.osize;
+      rel = xlink_x86_sign_extend(xlink_x86_fetch(cpu, size), size);
+      xlink_x86_jump(cpu, cpu->eip + rel);
+      return;
+    }
+    case 0xf5 : {
+      cpu->flags ^= X86_CF;
+      return;
+    }
+    case 0xf6 :
+    case 0xf7 : {
+      uint32_t value;
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      if (m.reg < 2) {
+        xlink_x86_alu(cpu, 4, xlink_x86_get_rm(cpu, &m, size),
+         xlink_x86_fetch(cpu, size), size);
+        return;
+      }
+      value = xlink_x86_get_rm(cpu, &m, size);
+      if (m.reg == 2) {
+        xlink_x86_set_rm(cpu, &m, size, ~value);
+      }
+      else if (m.reg == 3) {
+        xlink_x86_set_rm(cpu, &m, size, xlink_x86_alu(cpu, 5, 0, value, size));
+      }
+      else {
+        xlink_x86_multiply(cpu, m.reg, value, size);
+      }
+      return;
+    }
+    case 0xf8 :
+    case 0xf9 : {
+      xlink_x86_set_flag(cpu, X86_CF, op & 1);
+      return;
+    }
+    case 0xfc :
+    case 0xfd : {
+      xlink_x86_set_flag(cpu, X86_DF, op & 1);
+      return;
+    }
+    case 0xfe :
+    case 0xff : {
+      uint32_t value;
+      size = op & 1 ? pfx.osize : 1;
+      xlink_x86_decode_modrm(cpu, &pfx, &m);
+      if (m.reg < 2) {
+        int cf;
+        cf = cpu->flags & X86_CF;
+        xlink_x86_set_rm(cpu, &m, size, xlink_x86_alu(cpu, m.reg ? 5 : 0,
+         xlink_x86_get_rm(cpu, &m, size), 1, size));
+        xlink_x86_set_flag(cpu, X86_CF, cf);
+        return;
+      }
+      if (op == 0xfe) break;
+      switch (m.reg) {
+        case 2 :
+        case 4 : {
+          value = xlink_x86_get_rm(cpu, &m, pfx.osize);
+          if (m.reg == 2) {
+            xlink_x86_push(cpu, cpu->eip, pfx.osize);
+          }
+          xlink_x86_jump(cpu, value);
+          return;
+        }
+        case 3 :
+        case 5 : {
+          uint16_t sel;
+          XLINK_ERROR(m.rm != -1, ("Far pointer in register at "
+           "CS:EIP = %04x:%08x", cpu->sregs[XLINK_X86_CS], eip));
+          value = xlink_x86_read(cpu, m.addr, pfx.osize);
+          sel = xlink_x86_read(cpu, m.addr + pfx.osize, 2);
+          if (m.reg == 3) {
+            xlink_x86_push(cpu, cpu->sregs[XLINK_X86_CS], pfx.osize);
+            xlink_x86_push(cpu, cpu->eip, pfx.osize);
+          }
+          xlink_x86_load_segment(cpu, XLINK_X86_CS, sel);
+          xlink_x86_jump(cpu, value);
+          return;
+        }
+        case 6 : {
+          xlink_x86_push(cpu, xlink_x86_get_rm(cpu, &m, pfx.osize), pfx.osize);
+          return;
+        }
+      }
+      break;
+    }
+  }
+  xlink_x86_unsupported(cpu, eip, op);
+}
+
+int xlink_x86_run(xlink_x86 *cpu, uint32_t stop, long long limit) {
+  while (!cpu->exited && cpu->instructions < limit) {
+    if (cpu->protected) {
+      if (cpu->code32 && cpu->eip == stop) {
+        return 1;
+      }
+    }
+    else if (cpu->bases[XLINK_X86_CS] + cpu->eip == X86_DPMI_ENTRY) {
+      xlink_x86_enter_protected(cpu);
+      continue;
+    }
+    xlink_x86_step(cpu);
+  }
+  return 0;
+}
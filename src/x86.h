@@ -0,0 +1,67 @@
+#ifndef _XLINK_x86_h
+#define _XLINK_x86_h
+
+#include <stdint.h>
+
+/* Segment registers in the order they are encoded */
+#define XLINK_X86_ES (0)
+#define XLINK_X86_CS (1)
+#define XLINK_X86_SS (2)
+#define XLINK_X86_DS (3)
+#define XLINK_X86_FS (4)
+#define XLINK_X86_GS (5)
+
+/* Real mode segment the COM file is loaded at, with its PSP at offset 0 */
+#define XLINK_X86_PSP (0x1000)
+
+/* Linear address where DPMI memory blocks are allocated from */
+#define XLINK_X86_HEAP (0x1000000)
+
+typedef struct xlink_x86_selector xlink_x86_selector;
+
+struct xlink_x86_selector {
+  uint32_t base;
+  /* Set for 32-bit code segments */
+  int big;
+};
+
+/* A 386 interpreter for the subset of 16 and 32-bit instructions used by the
+   stubs, with the DOS and DPMI services they call emulated.  Memory is a flat
+   array of linear addresses and segment limits are not checked.  CPUID and
+   RDTSC are answered as on a Pentium, with the instruction count as the time
+   stamp for the timed stubs. */
+typedef struct xlink_x86 xlink_x86;
+
+struct xlink_x86 {
+  unsigned char *mem;
+  uint32_t size;
+  uint32_t regs[8];
+  uint32_t eip;
+  uint32_t flags;
+  uint16_t sregs[6];
+  uint32_t bases[6];
+  /* Set once the DPMI host has switched to protected mode */
+  int protected;
+  /* Set when CS is a 32-bit code segment */
+  int code32;
+  /* Set for a 32-bit DPMI client, whose stack pointer is ESP */
+  int stack32;
+  xlink_x86_selector selectors[8];
+  int nselectors;
+  /* Linear address of the next DPMI memory block */
+  uint32_t heap;
+  int exited;
+  int exit_code;
+  long long instructions;
+  long long reads;
+  long long writes;
+};
+
+void xlink_x86_init(xlink_x86 *cpu, uint32_t size);
+void xlink_x86_clear(xlink_x86 *cpu);
+void xlink_x86_load_com(xlink_x86 *cpu, const unsigned char *com, int size);
+/* Returns 1 when protected mode 32-bit code reaches stop, or 0 when the
+   program exits or limit instructions have run */
+int xlink_x86_run(xlink_x86 *cpu, uint32_t stop, long long limit);
+
+#endif
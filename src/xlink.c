@@ -5,12 +5,18 @@
 #include <getopt.h>
 #include <math.h>
 #include <float.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "ec.h"
 #include "internal.h"
 #include "io.h"
 #include "omf.h"
 #include "paq.h"
 #include "util.h"
+#include "x86.h"
 
 static const char *XLINK_SEGMENT_CLASS_NAME[] = {
   "CODE",
@@ -130,6 +136,27 @@ struct xlink_omf_record {
 
 typedef char xlink_string[256];
 
+/* An index by name, built by the first lookup and again whenever the number
+   of values to index has changed.  Only the count marks it stale, so code
+   that renames or replaces values in place must call xlink_index_drop(), as
+   xlink_module_rename_extern() does */
+typedef struct xlink_index xlink_index;
+
+struct xlink_index {
+  xlink_table table;
+  int count;
+};
+
+/* An entry of an index, with a second value of the same name kept to report
+   if the name is ever looked up */
+typedef struct xlink_symbol xlink_symbol;
+
+struct xlink_symbol {
+  const char *name;
+  void *value;
+  void *duplicate;
+};
+
 typedef struct xlink_module xlink_module;
 
 typedef struct xlink_name xlink_name;
@@ -168,7 +195,11 @@ struct xlink_segment {
   int ndatas;
   xlink_reloc **relocs;
   int nrelocs;
+  /* The first relocation to each extern by name, see find_reloc() */
+  xlink_index reloc_index;
   int start;
+  /* The identical segment this one was folded into with -F --fold */
+  xlink_segment *folded;
 };
 
 #define CEIL2(len, bits) (((len) + ((1 << (bits)) - 1)) >> (bits))
@@ -272,6 +303,10 @@ struct xlink_module {
   int ndatas;
   xlink_reloc **relocs;
   int nrelocs;
+  /* Indexes by name for the xlink_module_find_*() functions */
+  xlink_index segment_index;
+  xlink_index public_index;
+  xlink_index extern_index;
 };
 
 struct xlink_library {
@@ -288,6 +323,16 @@ struct xlink_binary {
   char *entry;
   char *init;
   int hash_table_memory;
+  /* Configurations to evaluate with -X --evaluate */
+  xlink_list configs;
+  /* Bytes over perfect hashing allowed when sizing with -A --auto-memory */
+  int auto_memory;
+  /* Names of segments that start a new EC segment, from -g --group */
+  xlink_list groups;
+  /* Seconds to spend reordering segments with -O --order */
+  double order_budget;
+  /* Unpack time allowed by -W --weigh and -Y --max-models */
+  xlink_budget budget;
   char *map;
   xlink_module **modules;
   int nmodules;
@@ -297,6 +342,9 @@ struct xlink_binary {
   int nsegments;
   xlink_extern **externs;
   int nexterns;
+  /* Index of the non-local publics by name, counting the modules and
+     librarys loaded */
+  xlink_index publics;
   /* Flag indicating that the main program is 32-bit */
   int is_32bit;
 };
@@ -341,11 +389,75 @@ int xlink_##parent##_has_##child(xlink_##parent *p, xlink_##child *c) {       \
   (c)->parent = p;                                                            \
   xlink_##parent##_add_##child(p, c);
 
+static unsigned int symbol_hash_code(const void *value) {
+  const unsigned char *name;
+  unsigned int hash;
+  name = (const unsigned char *)((const xlink_symbol *)value)->name;
+  /* FNV-1a over the name */
+  hash = 2166136261u;
+  while (*name) {
+    hash = (hash ^ *name++)*16777619u;
+  }
+  return hash;
+}
+
+static int symbol_equals(const void *a, const void *b) {
+  return strcmp(((const xlink_symbol *)a)->name,
+   ((const xlink_symbol *)b)->name) == 0;
+}
+
+void xlink_index_init(xlink_index *index, int count) {
+  xlink_table_init(&index->table, symbol_hash_code, symbol_equals,
+   sizeof(xlink_symbol), count, 0.75);
+  index->count = count;
+}
+
+/* Add value by name, or note it as a duplicate of the value already there */
+void xlink_index_add(xlink_index *index, const char *name, void *value) {
+  xlink_symbol sym;
+  xlink_symbol *found;
+  sym.name = name;
+  found = xlink_table_get(&index->table, &sym);
+  if (found == NULL) {
+    sym.value = value;
+    sym.duplicate = NULL;
+    xlink_table_add(&index->table, &sym);
+  }
+  else if (found->duplicate == NULL) {
+    found->duplicate = value;
+  }
+}
+
+xlink_symbol *xlink_index_get(xlink_index *index, const char *name) {
+  xlink_symbol key;
+  key.name = name;
+  return xlink_table_get(&index->table, &key);
+}
+
+/* Free the index so the next lookup builds it again */
+void xlink_index_drop(xlink_index *index) {
+  if (index->table.slots != NULL) {
+    xlink_table_clear(&index->table);
+  }
+  memset(index, 0, sizeof(xlink_index));
+}
+
+/* Returns 1 when index must be built for count values */
+int xlink_index_stale(xlink_index *index, int count) {
+  if (index->table.slots != NULL && index->count == count) {
+    return 0;
+  }
+  xlink_index_drop(index);
+  xlink_index_init(index, count);
+  return 1;
+}
+
 XLINK_LIST_FUNCS(segment, public);
 XLINK_LIST_FUNCS(segment, data);
 XLINK_LIST_FUNCS(segment, reloc);
 
 void xlink_segment_clear(xlink_segment *segment) {
+  xlink_index_drop(&segment->reloc_index);
   free(segment->data);
   free(segment->mask);
   free(segment->publics);
@@ -490,6 +602,9 @@ void xlink_module_clear(xlink_module *mod) {
     free(mod->relocs[i]);
   }
   free(mod->relocs);
+  xlink_index_drop(&mod->segment_index);
+  xlink_index_drop(&mod->public_index);
+  xlink_index_drop(&mod->extern_index);
   memset(mod, 0, sizeof(xlink_module));
 }
 
@@ -506,6 +621,8 @@ void xlink_binary_init(xlink_binary *bin) {
   memset(bin, 0, sizeof(xlink_binary));
   bin->entry = "main_";
   bin->hash_table_memory = 12*1024*1024;
+  xlink_list_init(&bin->configs, sizeof(xlink_config), 0);
+  xlink_list_init(&bin->groups, sizeof(const char *), 0);
 }
 
 void xlink_binary_clear(xlink_binary *bin) {
@@ -522,6 +639,9 @@ void xlink_binary_clear(xlink_binary *bin) {
   free(bin->librarys);
   free(bin->segments);
   free(bin->externs);
+  xlink_list_clear(&bin->configs);
+  xlink_list_clear(&bin->groups);
+  xlink_index_drop(&bin->publics);
   memset(bin, 0, sizeof(xlink_binary));
 }
 
@@ -545,61 +665,75 @@ XLINK_LIST_FUNCS(module, extern);
 XLINK_LIST_FUNCS(module, reloc);
 
 xlink_segment *xlink_module_find_segment(xlink_module *mod, const char *name) {
-  xlink_segment *ret;
-  int i;
-  ret = NULL;
-  for (i = 1; i <= mod->nsegments; i++) {
-    xlink_segment *seg;
-    seg = xlink_module_get_segment(mod, i);
-    if (strcmp(name, seg->name->str) == 0) {
-      XLINK_ERROR(ret != NULL,
-       ("Duplicate segment definition found for name %s in %s", name,
-       mod->filename));
-      ret = seg;
+  xlink_symbol *sym;
+  if (xlink_index_stale(&mod->segment_index, mod->nsegments)) {
+    int i;
+    for (i = 1; i <= mod->nsegments; i++) {
+      xlink_segment *seg;
+      seg = xlink_module_get_segment(mod, i);
+      xlink_index_add(&mod->segment_index, seg->name->str, seg);
     }
   }
-  XLINK_ERROR(ret == NULL,
+  sym = xlink_index_get(&mod->segment_index, name);
+  XLINK_ERROR(sym == NULL,
    ("Could not find segment definition %s in %s", name, mod->filename));
-  return ret;
+  XLINK_ERROR(sym->duplicate != NULL,
+   ("Duplicate segment definition found for name %s in %s", name,
+   mod->filename));
+  return sym->value;
 }
 
 xlink_public *xlink_module_find_public(xlink_module *mod, const char *symb) {
-  xlink_public *ret;
-  int i;
-  ret = NULL;
-  for (i = 1; i <= mod->npublics; i++) {
-    xlink_public *pub;
-    pub = xlink_module_get_public(mod, i);
-    /* TODO: Why was this check added? */
-    if (/*pub->is_local &&*/ strcmp(symb, pub->name) == 0) {
-      XLINK_ERROR(ret != NULL,
-       ("Duplicate local public definition found for symbol %s in %s", symb,
-       mod->filename));
-      ret = pub;
+  xlink_symbol *sym;
+  if (xlink_index_stale(&mod->public_index, mod->npublics)) {
+    int i;
+    for (i = 1; i <= mod->npublics; i++) {
+      xlink_public *pub;
+      pub = xlink_module_get_public(mod, i);
+      /* TODO: Why was this check added? */
+      /*if (pub->is_local)*/
+      xlink_index_add(&mod->public_index, pub->name, pub);
     }
   }
-  XLINK_ERROR(ret == NULL,
+  sym = xlink_index_get(&mod->public_index, symb);
+  XLINK_ERROR(sym == NULL,
    ("Could not find local public definition %s in %s", symb, mod->filename));
-  return ret;
+  XLINK_ERROR(sym->duplicate != NULL,
+   ("Duplicate local public definition found for symbol %s in %s", symb,
+   mod->filename));
+  return sym->value;
 }
 
 xlink_extern *xlink_module_find_extern(xlink_module *mod, const char *name) {
-  xlink_extern *ret;
-  int i;
-  ret = NULL;
-  for (i = 1; i <= mod->nexterns; i++) {
-    xlink_extern *ext;
-    ext = xlink_module_get_extern(mod, i);
-    if (!ext->is_local && strcmp(name, ext->name) == 0) {
-      XLINK_ERROR(ret != NULL,
-       ("Duplicate extern definition found for name %s in %s", name,
-       mod->filename));
-      ret = ext;
+  xlink_symbol *sym;
+  if (xlink_index_stale(&mod->extern_index, mod->nexterns)) {
+    int i;
+    for (i = 1; i <= mod->nexterns; i++) {
+      xlink_extern *ext;
+      ext = xlink_module_get_extern(mod, i);
+      if (!ext->is_local) {
+        xlink_index_add(&mod->extern_index, ext->name, ext);
+      }
     }
   }
-  XLINK_ERROR(ret == NULL,
+  sym = xlink_index_get(&mod->extern_index, name);
+  XLINK_ERROR(sym == NULL,
    ("Could not find extern definition %s in %s", name, mod->filename));
-  return ret;
+  XLINK_ERROR(sym->duplicate != NULL,
+   ("Duplicate extern definition found for name %s in %s", name,
+   mod->filename));
+  return sym->value;
+}
+
+/* Rename the extern name of mod, dropping the indexes keyed by its name */
+void xlink_module_rename_extern(xlink_module *mod, const char *name,
+ const char *rename) {
+  int i;
+  strcpy(xlink_module_find_extern(mod, name)->name, rename);
+  xlink_index_drop(&mod->extern_index);
+  for (i = 1; i <= mod->nsegments; i++) {
+    xlink_index_drop(&xlink_module_get_segment(mod, i)->reloc_index);
+  }
 }
 
 XLINK_LIST_FUNCS(library, module);
@@ -607,44 +741,46 @@ XLINK_LIST_FUNCS(library, module);
 XLINK_LIST_FUNCS(binary, module);
 XLINK_LIST_FUNCS(binary, library);
 
-xlink_public *xlink_binary_find_public(xlink_binary *bin, const char *symb) {
-  xlink_public *ret;
-  int i, j, k;
-  ret = NULL;
-  for (i = 1; i <= bin->nmodules; i++) {
-    xlink_module *mod;
-    mod = xlink_binary_get_module(bin, i);
-    for (j = 1; j <= mod->npublics; j++) {
-      xlink_public *pub;
-      pub = xlink_module_get_public(mod, j);
-      if (!pub->is_local && strcmp(symb, pub->name) == 0) {
-        XLINK_ERROR(ret != NULL,
-         ("Duplicate public definition found for symbol %s in %s and %s",
-         symb, ret->module->filename, mod->filename));
-        ret = pub;
-      }
+static void xlink_binary_index_module(xlink_binary *bin, xlink_module *mod) {
+  int i;
+  for (i = 1; i <= mod->npublics; i++) {
+    xlink_public *pub;
+    pub = xlink_module_get_public(mod, i);
+    if (!pub->is_local) {
+      xlink_index_add(&bin->publics, pub->name, pub);
     }
   }
+}
+
+/* Index the non-local publics of every module and library module in one
+    pass, noting duplicate definitions as they are found */
+void xlink_binary_index_publics(xlink_binary *bin) {
+  int i, j;
+  for (i = 1; i <= bin->nmodules; i++) {
+    xlink_binary_index_module(bin, xlink_binary_get_module(bin, i));
+  }
   for (i = 1; i <= bin->nlibrarys; i++) {
     xlink_library *lib;
     lib = xlink_binary_get_library(bin, i);
     for (j = 1; j <= lib->nmodules; j++) {
-      xlink_module *mod;
-      mod = xlink_library_get_module(lib, j);
-      for (k = 1; k <= mod->npublics; k++) {
-        xlink_public *pub;
-        pub = xlink_module_get_public(mod, k);
-        if (!pub->is_local && strcmp(symb, pub->name) == 0) {
-          XLINK_ERROR(ret != NULL,
-           ("Duplicate public definition found for symbol %s in %s and %s",
-           symb, ret->module->filename, mod->filename));
-          ret = pub;
-        }
-      }
+      xlink_binary_index_module(bin, xlink_library_get_module(lib, j));
     }
   }
-  XLINK_ERROR(ret == NULL, ("Could not find public definition %s", symb));
-  return ret;
+}
+
+xlink_public *xlink_binary_find_public(xlink_binary *bin, const char *symb) {
+  xlink_symbol *sym;
+  /* Index once all inputs are loaded, again if any are loaded after */
+  if (xlink_index_stale(&bin->publics, bin->nmodules + bin->nlibrarys)) {
+    xlink_binary_index_publics(bin);
+  }
+  sym = xlink_index_get(&bin->publics, symb);
+  XLINK_ERROR(sym == NULL, ("Could not find public definition %s", symb));
+  XLINK_ERROR(sym->duplicate != NULL,
+   ("Duplicate public definition found for symbol %s in %s and %s", symb,
+   ((xlink_public *)sym->value)->module->filename,
+   ((xlink_public *)sym->duplicate)->module->filename));
+  return sym->value;
 }
 
 XLINK_LIST_FUNCS(binary, segment);
@@ -728,6 +864,7 @@ void xlink_segment_apply_relocations(xlink_segment *segment) {
       case OMF_TARGET_SEG : {
         xlink_segment *seg;
         seg = xlink_module_get_segment(segment->module, rel->target_idx);
+        for (; seg->folded != NULL; seg = seg->folded);
         target = seg->start;
         break;
       }
@@ -1048,9 +1185,10 @@ void xlink_module_split_segments(xlink_module *mod) {
         segs[m]->publics = NULL;
         segs[m]->relocs = NULL;
         segs[m]->npublics = segs[m]->nrelocs = 0;
+        memset(&segs[m]->reloc_index, 0, sizeof(xlink_index));
         segs[m]->length = seg->length - offsets[m];
         if (seg->info & SEG_HAS_DATA) {
-          segs[m]->data = xlink_malloc(segs[m]->length);
+          segs[m]->data = xlink_malloc_uninit(segs[m]->length);
           segs[m]->mask = NULL;
           memcpy(segs[m]->data, &seg->data[offsets[m]], segs[m]->length);
         }
@@ -1188,6 +1326,21 @@ int xlink_omf_record_load_iterated(xlink_omf_record *rec, unsigned char *data,
 #define MOD_CLAMP (0x80)
 #define MOD_EXIT  (0x100)
 #define MOD_BASE  (0x200)
+#define MOD_PARANOID (0x400)
+#define MOD_EVALUATE (0x800)
+#define MOD_TUNE  (0x1000)
+#define MOD_AUTO_MEMORY (0x2000)
+#define MOD_AUTO_ONE (0x4000)
+#define MOD_ORDER (0x8000)
+#define MOD_FOLD  (0x10000)
+#define MOD_RUN   (0x20000)
+#define MOD_TAG   (0x40000)
+#define MOD_SPEED (0x80000)
+#define MOD_HISTORY (0x100000)
+#define MOD_BUCKET (0x200000)
+#define MOD_TIME  (0x400000)
+#define MOD_WEIGH (0x800000)
+#define MOD_MAX_MODELS (0x1000000)
 
 xlink_module *xlink_file_load_omf_module(xlink_file *file, unsigned int flags) {
   xlink_module *mod;
@@ -1246,8 +1399,10 @@ xlink_module *xlink_file_load_omf_module(xlink_file *file, unsigned int flags) {
         /* Read and ignore Overlay Name Index */
         xlink_omf_record_read_index(&rec);
         seg->info = 0;
-        seg->data = xlink_malloc(seg->length);
-        seg->mask = xlink_malloc(CEIL2(seg->length, 3));
+        /* Every byte of data must be written by LEDATA or LIDATA records, as
+           tracked by mask, or the segment is left uninitialized */
+        seg->data = xlink_malloc_uninit(seg->length);
+        seg->mask = xlink_malloc_uninit(CEIL2(seg->length, 3));
         xlink_segment_reset_mask(seg);
         XLINK_LIST_ADD(module, segment, mod, seg);
         break;
@@ -1325,8 +1480,8 @@ xlink_module *xlink_file_load_omf_module(xlink_file *file, unsigned int flags) {
         dat->offset = xlink_omf_record_read_numeric(&rec);
         dat->is_iterated = rec.type & 0x2;
         dat->length = xlink_omf_record_data_left(&rec);
-        dat->data = xlink_malloc(dat->length);
-        dat->mask = xlink_malloc(CEIL2(dat->length, 3));
+        dat->data = xlink_malloc_uninit(dat->length);
+        dat->mask = xlink_malloc_uninit(CEIL2(dat->length, 3));
         memcpy(dat->data, &rec.buf[rec.idx], dat->length);
         xlink_data_reset_mask(dat);
         if (!dat->is_iterated) {
@@ -1672,42 +1827,186 @@ void xlink_apply_relocations(xlink_segment **segments, int nsegments) {
   }
 }
 
-int xlink_binary_extract_class(xlink_binary *bin, int index, int offset,
- xlink_segment_class class, xlink_list *bytes) {
+/* Find the segment and offset a relocation targets, following folded
+    segments, where the segment is NULL for an absolute public */
+static xlink_segment *xlink_reloc_get_target(xlink_reloc *rel, int *offset) {
+  xlink_segment *seg;
+  *offset = rel->addend.offset;
+  switch (rel->target) {
+    case OMF_TARGET_EXT : {
+      xlink_public *pub;
+      pub = xlink_module_get_extern(rel->module, rel->target_idx)->public;
+      *offset += pub->offset;
+      seg = pub->segment;
+      break;
+    }
+    case OMF_TARGET_SEG : {
+      seg = xlink_module_get_segment(rel->module, rel->target_idx);
+      break;
+    }
+    default : {
+      XLINK_ERROR(1, ("Unsupported target T%i", rel->target));
+    }
+  }
+  for (; seg != NULL && seg->folded != NULL; seg = seg->folded);
+  return seg;
+}
+
+static unsigned int segment_hash_code(const void *value) {
+  const xlink_segment *seg;
+  unsigned int hash;
   int i;
-  for (i = index + 1; i <= bin->nsegments; i++) {
-    xlink_segment *seg;
-    seg = xlink_binary_get_segment(bin, i);
-    if (xlink_segment_get_class(seg) != class) break;
-    XLINK_ERROR(seg->info & SEG_HAS_DATA == 0,
-     ("Error segment %s has no data", xlink_segment_get_name(seg)));
-    if (offset != seg->start) {
-      unsigned char buf[4096];
-      memset(buf, 0, 4096);
-      xlink_list_add_all(bytes, buf, seg->start - offset);
-      offset = seg->start;
+  seg = *(xlink_segment **)value;
+  /* FNV-1a over the data, then the relocation offsets and locations */
+  hash = 2166136261u;
+  for (i = 0; i < seg->length; i++) {
+    hash = (hash ^ seg->data[i])*16777619u;
+  }
+  for (i = 0; i < seg->nrelocs; i++) {
+    hash = (hash ^ seg->relocs[i]->offset)*16777619u;
+    hash = (hash ^ seg->relocs[i]->location)*16777619u;
+  }
+  return hash;
+}
+
+/* Two segments are identical when their attributes and data match, and each
+    relocation patches the same place with the same target, where a target
+    inside either segment matches the same offset inside the other */
+static int segment_equals(const void *a, const void *b) {
+  xlink_segment *seg_a;
+  xlink_segment *seg_b;
+  int i;
+  seg_a = *(xlink_segment **)a;
+  seg_b = *(xlink_segment **)b;
+  if (seg_a->attrib.b != seg_b->attrib.b || seg_a->length != seg_b->length ||
+   seg_a->nrelocs != seg_b->nrelocs ||
+   strcmp(seg_a->class->str, seg_b->class->str) != 0 ||
+   memcmp(seg_a->data, seg_b->data, seg_a->length) != 0) {
+    return 0;
+  }
+  for (i = 0; i < seg_a->nrelocs; i++) {
+    xlink_reloc *rel_a;
+    xlink_reloc *rel_b;
+    xlink_segment *target_a;
+    xlink_segment *target_b;
+    int offset_a;
+    int offset_b;
+    rel_a = seg_a->relocs[i];
+    rel_b = seg_b->relocs[i];
+    if (rel_a->offset != rel_b->offset || rel_a->mode != rel_b->mode ||
+     rel_a->location != rel_b->location) {
+      return 0;
+    }
+    target_a = xlink_reloc_get_target(rel_a, &offset_a);
+    target_b = xlink_reloc_get_target(rel_b, &offset_b);
+    if (target_a == seg_a && target_b == seg_b) {
+      target_a = target_b;
+    }
+    if (target_a != target_b || offset_a != offset_b) {
+      return 0;
     }
-    xlink_list_add_all(bytes, seg->data, seg->length);
-    offset += seg->length;
   }
-  return offset;
+  return 1;
+}
+
+/* Fold identical CODE segments from index on into the first copy, moving
+    their publics to it so that every reference resolves to the survivor.
+    Folding one pair can make the segments that call them identical, so
+    repeat until nothing changes.  Writable DATA is never folded. */
+void xlink_binary_fold_segments(xlink_binary *bin, int index) {
+  xlink_table table;
+  int nsegments;
+  int bytes;
+  int folded;
+  int i, j;
+  nsegments = bin->nsegments;
+  bytes = 0;
+  xlink_table_init(&table, segment_hash_code, segment_equals,
+   sizeof(xlink_segment *), bin->nsegments - index, 0.75);
+  do {
+    folded = 0;
+    xlink_table_reset(&table);
+    for (i = j = index; i < bin->nsegments; i++) {
+      xlink_segment *seg;
+      xlink_segment **keep;
+      seg = bin->segments[i];
+      if (xlink_segment_get_class(seg) == OMF_SEGMENT_CODE) {
+        keep = xlink_table_get(&table, &seg);
+        if (keep != NULL) {
+          int k;
+          seg->folded = *keep;
+          for (k = 0; k < seg->npublics; k++) {
+            seg->publics[k]->segment = *keep;
+            xlink_segment_add_public(*keep, seg->publics[k]);
+          }
+          qsort((*keep)->publics, (*keep)->npublics, sizeof(xlink_public *),
+           pub_comp);
+          bytes += seg->length;
+          folded++;
+          continue;
+        }
+        xlink_table_add(&table, &seg);
+      }
+      bin->segments[j++] = seg;
+    }
+    bin->nsegments = j;
+  }
+  while (folded > 0);
+  xlink_table_clear(&table);
+  printf("Folded %i identical segments, %i bytes\n",
+   nsegments - bin->nsegments, bytes);
 }
 
 #define xlink_list_get_model(list, i) ((xlink_model *)xlink_list_get(list, i))
 
 #define XLINK_RATIO(packed, bytes) (100*(1 - (((double)(packed))/(bytes))))
 
-void xlink_model_search(xlink_list *models, xlink_list *bytes) {
+typedef struct xlink_search xlink_search;
+
+struct xlink_search {
   xlink_modeler mod;
+  xlink_list *models;
+  xlink_list *bytes;
+  const xlink_budget *budget;
+};
+
+/* Runs on its own thread, the results are printed by xlink_search_clear() */
+void *xlink_search_models(void *arg) {
+  xlink_search *search;
+  search = arg;
   /* Build a context modeler for bytes */
-  xlink_modeler_init(&mod, xlink_list_length(bytes));
-  xlink_modeler_load_binary(&mod, bytes);
+  xlink_modeler_init(&search->mod, xlink_list_length(search->bytes));
+  xlink_modeler_load_binary(&search->mod, search->bytes);
+  search->mod.budget = *search->budget;
   /* Search for the best context to use for bytes */
-  xlink_list_empty(models);
-  xlink_modeler_search(&mod, models);
-  XLINK_ERROR(xlink_list_length(models) == 0,
+  xlink_list_empty(search->models);
+  xlink_modeler_search(&search->mod, search->models);
+  return NULL;
+}
+
+void xlink_search_init(xlink_search *search, xlink_list *models,
+ xlink_list *bytes, const xlink_budget *budget) {
+  search->models = models;
+  search->bytes = bytes;
+  search->budget = budget;
+}
+
+void xlink_search_clear(xlink_search *search) {
+  xlink_modeler_print(&search->mod, search->models);
+  XLINK_ERROR(xlink_list_length(search->models) == 0,
    ("Error no context models found for bytes"));
-  xlink_modeler_clear(&mod);
+  xlink_modeler_clear(&search->mod);
+}
+
+void xlink_model_search(xlink_list *models, xlink_list *bytes,
+ const xlink_budget *budget) {
+  xlink_search search;
+  printf("Searching %i bytes for best context... ", xlink_list_length(bytes));
+  fflush(stdout);
+  xlink_search_init(&search, models, bytes, budget);
+  xlink_search_models(&search);
+  printf("done\n");
+  xlink_search_clear(&search);
 }
 
 typedef struct xlink_ec_segment xlink_ec_segment;
@@ -1730,6 +2029,108 @@ void xlink_ec_segment_clear(xlink_ec_segment *ec) {
   xlink_list_clear(&ec->models);
 }
 
+/* Split the CODE and DATA segments into a list of EC segments, starting a new
+    one at the first DATA segment and at every segment named in groups */
+int xlink_binary_extract_segments(xlink_binary *bin, int index, int offset,
+ xlink_list *ecs) {
+  xlink_ec_segment *ec;
+  xlink_segment_class last;
+  int i, j;
+  ec = NULL;
+  last = OMF_SEGMENT_CODE;
+  for (i = index + 1; i <= bin->nsegments; i++) {
+    xlink_segment *seg;
+    xlink_segment_class class;
+    int split;
+    seg = xlink_binary_get_segment(bin, i);
+    class = xlink_segment_get_class(seg);
+    if (class != OMF_SEGMENT_CODE && class != OMF_SEGMENT_DATA) break;
+    XLINK_ERROR((seg->info & SEG_HAS_DATA) == 0,
+     ("Error segment %s has no data", xlink_segment_get_name(seg)));
+    split = ec == NULL || class != last;
+    for (j = 0; j < xlink_list_length(&bin->groups); j++) {
+      split |= strcmp(seg->name->str,
+       *(const char **)xlink_list_get(&bin->groups, j)) == 0;
+    }
+    /* Reuse the last EC segment if it is still empty */
+    if (split && (ec == NULL || xlink_list_length(&ec->bytes) > 0)) {
+      xlink_ec_segment new;
+      xlink_ec_segment_init(&new);
+      ec = xlink_list_get(ecs, xlink_list_add(ecs, &new) - 1);
+    }
+    if (offset != seg->start) {
+      unsigned char buf[4096];
+      memset(buf, 0, 4096);
+      xlink_list_add_all(&ec->bytes, buf, seg->start - offset);
+      offset = seg->start;
+    }
+    xlink_list_add_all(&ec->bytes, seg->data, seg->length);
+    offset += seg->length;
+    last = class;
+  }
+  /* Drop a trailing EC segment without any bytes, the first is always kept */
+  if (xlink_list_length(ecs) > 1 && xlink_list_length(&ec->bytes) == 0) {
+    xlink_ec_segment_clear(ec);
+    xlink_list_remove(ecs, xlink_list_length(ecs) - 1);
+  }
+  return offset;
+}
+
+/* Search once for the best contexts of the CODE and DATA bytes together, then
+    score both layouts with those models.  Modeler counts are causal, so a
+    prefix view of the same modeler gives the CODE counts.  A suffix view
+    would carry the CODE counts into DATA though, while the stub resets the
+    context before the DATA bytes, so they are loaded into their own modeler
+    and only scored, not searched.  The two EC segment cost is an upper bound
+    since each segment could have its own models.  Returns 1 and sets the
+    models of code when the DATA bytes were moved into a single EC segment,
+    or returns 0 so the segments are searched one by one. */
+int xlink_search_layouts(xlink_ec_segment *code, xlink_ec_segment *data,
+ const xlink_budget *budget) {
+  xlink_list bytes;
+  xlink_modeler mod;
+  xlink_modeler prefix;
+  xlink_modeler suffix;
+  double one;
+  double two;
+  printf("Searching %i bytes for one EC segment context... ",
+   xlink_list_length(&code->bytes) + xlink_list_length(&data->bytes));
+  fflush(stdout);
+  xlink_list_init(&bytes, sizeof(unsigned char), 0);
+  xlink_list_append(&bytes, &code->bytes);
+  xlink_list_append(&bytes, &data->bytes);
+  xlink_modeler_init(&mod, xlink_list_length(&bytes));
+  xlink_modeler_load_binary(&mod, &bytes);
+  mod.budget = *budget;
+  xlink_modeler_search(&mod, &code->models);
+  printf("done\n");
+  xlink_modeler_prefix(&prefix, &mod, xlink_list_length(&code->bytes));
+  xlink_modeler_init(&suffix, xlink_list_length(&data->bytes));
+  xlink_modeler_load_binary(&suffix, &data->bytes);
+  suffix.budget = *budget;
+  /* Compare the layouts including the unpack time charged by the budget */
+  one = xlink_modeler_get_cost(&mod, &code->models);
+  two = xlink_modeler_get_cost(&prefix, &code->models) +
+   xlink_modeler_get_cost(&suffix, &code->models);
+  printf("One EC segment: %0.3lf bits cost\n", one);
+  printf("Two EC segments: %0.3lf bits cost or less\n", two);
+  if (one < two) {
+    xlink_modeler_print(&mod, &code->models);
+    XLINK_ERROR(xlink_list_length(&code->models) == 0,
+     ("Error no context models found for bytes"));
+    xlink_list_append(&code->bytes, &data->bytes);
+    xlink_list_empty(&data->bytes);
+  }
+  else {
+    xlink_list_empty(&code->models);
+  }
+  printf("Using %s\n", one < two ? "one EC segment" : "two EC segments");
+  xlink_modeler_clear(&suffix);
+  xlink_modeler_clear(&mod);
+  xlink_list_clear(&bytes);
+  return one < two;
+}
+
 void xlink_decoder_test_bytes(xlink_decoder *dec, xlink_list *bytes) {
   int i;
   for (i = 0; i < xlink_list_length(bytes); i++) {
@@ -1742,69 +2143,611 @@ void xlink_decoder_test_bytes(xlink_decoder *dec, xlink_list *bytes) {
   }
 }
 
+/* Unless paranoid is set, the decoder checks the range coder against the
+    counts traced by the encoder rather than re-running the context model */
 void xlink_bitstream_from_context(xlink_bitstream *bs, xlink_context *ctx,
- xlink_list *bytes) {
+ xlink_list *bytes, int paranoid) {
   xlink_encoder enc;
   xlink_decoder dec;
+  xlink_list trace;
   bs->bytes.length = 0;
+  xlink_list_init(&trace, sizeof(xlink_bit_counts), 8*xlink_list_length(bytes));
   /* Reset the context */
   xlink_context_reset(ctx);
   /* Encode bytes with the context */
   xlink_encoder_init(&enc, ctx);
+  if (!paranoid) {
+    enc.trace = &trace;
+  }
   xlink_encoder_write_bytes(&enc, bytes);
   /* Finalize the bitstream */
   xlink_encoder_finalize(&enc, bs);
   xlink_encoder_clear(&enc);
-  /* Reset the context */
-  xlink_context_reset(ctx);
-  /* Initialize the decoder with the context and bitstream */
-  xlink_decoder_init(&dec, ctx, bs);
+  if (paranoid) {
+    /* Reset the context */
+    xlink_context_reset(ctx);
+    /* Initialize the decoder with the context and bitstream */
+    xlink_decoder_init(&dec, ctx, bs);
+  }
+  else {
+    /* Initialize the decoder with the traced counts and bitstream */
+    xlink_decoder_init(&dec, NULL, bs);
+    dec.trace = &trace;
+  }
   /* Test that decoded bytes match original input */
   xlink_decoder_test_bytes(&dec, bytes);
   xlink_decoder_clear(&dec);
+  xlink_list_clear(&trace);
 }
 
-void xlink_bitstream_from_segments(xlink_bitstream *bs, xlink_ec_segment *code,
- xlink_ec_segment *data, int capacity, int fast, int clamp) {
+/* Search for the best contexts of every EC segment, one per thread */
+void xlink_search_segments(xlink_ec_segment *ecs, int necs,
+ const xlink_budget *budget) {
+  xlink_search *searches;
+  pthread_t *threads;
+  int length;
+  int j;
+  searches = xlink_malloc(necs*sizeof(xlink_search));
+  threads = xlink_malloc(necs*sizeof(pthread_t));
+  length = 0;
+  for (j = 0; j < necs; j++) {
+    length += xlink_list_length(&ecs[j].bytes);
+    xlink_search_init(&searches[j], &ecs[j].models, &ecs[j].bytes, budget);
+  }
+  printf("Searching %i bytes for best contexts... ", length);
+  fflush(stdout);
+  for (j = 1; j < necs; j++) {
+    XLINK_ERROR(
+     pthread_create(&threads[j], NULL, xlink_search_models, &searches[j]),
+     ("Unable to create model search thread"));
+  }
+  xlink_search_models(&searches[0]);
+  for (j = 1; j < necs; j++) {
+    pthread_join(threads[j], NULL);
+  }
+  printf("done\n");
+  for (j = 0; j < necs; j++) {
+    xlink_search_clear(&searches[j]);
+  }
+  free(searches);
+  free(threads);
+}
+
+typedef struct xlink_verify xlink_verify;
+
+struct xlink_verify {
+  xlink_pipe pipe;
+  xlink_ec_segment *ecs;
+  int necs;
+  int capacity;
+  int hash;
+  int clamp;
+};
+
+/* Decode the bitstream while it is being encoded, using a separate context
+    to check that the bytes of each EC segment match the original input */
+void *xlink_verify_segments(void *arg) {
+  xlink_verify *ver;
+  xlink_decoder dec;
+  xlink_context ctx;
+  int j;
+  ver = arg;
+  /* Create a context from the first EC segment models */
+  xlink_context_init(&ctx, &ver->ecs[0].models, ver->capacity, ver->hash,
+   ver->clamp);
+  /* Initialize the decoder with the context and the encoder's pipe */
+  xlink_decoder_init_pipe(&dec, &ctx, &ver->pipe);
+  for (j = 0; j < ver->necs; j++) {
+    /* Skip EC segments without any bytes */
+    if (j > 0 && xlink_list_length(&ver->ecs[j].bytes) == 0) continue;
+    /* Reset the context with the models for this EC segment */
+    if (j > 0) {
+      xlink_context_set_models(&ctx, &ver->ecs[j].models);
+    }
+    /* Test that decoded bytes match original input */
+    xlink_decoder_test_bytes(&dec, &ver->ecs[j].bytes);
+  }
+  xlink_decoder_clear(&dec);
+  xlink_context_clear(&ctx);
+  return NULL;
+}
+
+typedef struct xlink_ec_model xlink_ec_model;
+
+struct xlink_ec_model {
+  xlink_context ctx;
+  xlink_list *bytes;
+  xlink_list trace;
+};
+
+void *xlink_ec_model_trace(void *arg) {
+  xlink_ec_model *ecm;
+  ecm = arg;
+  xlink_context_trace_bytes(&ecm->ctx, ecm->bytes, &ecm->trace);
+  return NULL;
+}
+
+void xlink_ec_model_init(xlink_ec_model *ecm, xlink_ec_segment *ec,
+ int capacity, int hash, int clamp) {
+  xlink_context_init(&ecm->ctx, &ec->models, capacity, hash, clamp);
+  ecm->bytes = &ec->bytes;
+  xlink_list_init(&ecm->trace, sizeof(xlink_bit_counts),
+   8*xlink_list_length(&ec->bytes));
+}
+
+void xlink_ec_model_clear(xlink_ec_model *ecm) {
+  xlink_context_clear(&ecm->ctx);
+  xlink_list_clear(&ecm->trace);
+}
+
+/* The EC segments are modeled independently, since the context is reset
+    between them, so their counts are traced on separate threads before a
+    single range coding pass over all of them */
+void xlink_bitstream_from_segments(xlink_bitstream *bs, xlink_ec_segment *ecs,
+ int necs, int capacity, int hash, int clamp, int paranoid) {
   xlink_encoder enc;
   xlink_decoder dec;
   xlink_context ctx;
-  int i;
+  xlink_ec_model *ecms;
+  pthread_t *threads;
+  xlink_verify ver;
+  pthread_t thread;
+  int i, j;
   xlink_bitstream_init(bs);
-  /* Create a context from code models */
-  xlink_context_init(&ctx, &code->models, capacity, fast, clamp);
+  if (!paranoid) {
+    ecms = xlink_malloc(necs*sizeof(xlink_ec_model));
+    threads = xlink_malloc(necs*sizeof(pthread_t));
+    for (j = 0; j < necs; j++) {
+      xlink_ec_model_init(&ecms[j], &ecs[j], capacity, hash, clamp);
+      if (j == 0) {
+        /* The encoder starts by updating the first context with 1 bit */
+        xlink_context_update_bit(&ecms[j].ctx, 0, 1);
+      }
+      else {
+        xlink_list *bytes;
+        /* Each context starts with the history left by the one before it */
+        memcpy(ecms[j].ctx.buf, ecms[j - 1].ctx.buf, sizeof(ecms[j].ctx.buf));
+        bytes = &ecs[j - 1].bytes;
+        for (i = XLINK_MAX(0, xlink_list_length(bytes) - 8);
+         i < xlink_list_length(bytes); i++) {
+          memmove(&ecms[j].ctx.buf[1], &ecms[j].ctx.buf[0], 7);
+          ecms[j].ctx.buf[0] = *xlink_list_get_byte(bytes, i);
+        }
+      }
+    }
+    for (j = 1; j < necs; j++) {
+      XLINK_ERROR(
+       pthread_create(&threads[j], NULL, xlink_ec_model_trace, &ecms[j]),
+       ("Unable to create modeling thread"));
+    }
+    xlink_ec_model_trace(&ecms[0]);
+    for (j = 1; j < necs; j++) {
+      pthread_join(threads[j], NULL);
+    }
+    /* Encode the bytes of every EC segment with the traced counts */
+    xlink_encoder_init(&enc, NULL);
+    for (j = 0; j < necs; j++) {
+      xlink_encoder_write_trace(&enc, &ecs[j].bytes, &ecms[j].trace);
+    }
+    /* Finalize the bitstream */
+    xlink_encoder_finalize(&enc, bs);
+    xlink_encoder_clear(&enc);
+    /* Initialize the decoder with the traced counts and bitstream */
+    xlink_decoder_init(&dec, NULL, bs);
+    /* Test that decoded bytes match original input */
+    for (j = 0; j < necs; j++) {
+      dec.trace = &ecms[j].trace;
+      dec.trace_pos = 0;
+      xlink_decoder_test_bytes(&dec, &ecs[j].bytes);
+    }
+    xlink_decoder_clear(&dec);
+    for (j = 0; j < necs; j++) {
+      xlink_ec_model_clear(&ecms[j]);
+    }
+    free(ecms);
+    free(threads);
+    return;
+  }
+  /* Create a context from the first EC segment models */
+  xlink_context_init(&ctx, &ecs[0].models, capacity, hash, clamp);
   /* Create an encoder from the context */
   xlink_encoder_init(&enc, &ctx);
-  /* Encode the code bytes */
-  xlink_encoder_write_bytes(&enc, &code->bytes);
-  /* If the data segment has any bytes */
-  if (xlink_list_length(&data->bytes) > 0) {
-    /* Reset the context with the data models */
-    ctx.models = &data->models;
-    xlink_set_reset(&ctx.matches);
-    /* Encode the code bytes */
-    xlink_encoder_write_bytes(&enc, &data->bytes);
+  /* Run the full decoder concurrently on the bits as they are finalized */
+  xlink_pipe_init(&ver.pipe);
+  ver.ecs = ecs;
+  ver.necs = necs;
+  ver.capacity = capacity;
+  ver.hash = hash;
+  ver.clamp = clamp;
+  enc.pipe = &ver.pipe;
+  XLINK_ERROR(pthread_create(&thread, NULL, xlink_verify_segments, &ver),
+   ("Unable to create verification thread"));
+  for (j = 0; j < necs; j++) {
+    /* Skip EC segments without any bytes */
+    if (j > 0 && xlink_list_length(&ecs[j].bytes) == 0) continue;
+    /* Reset the context with the models for this EC segment */
+    if (j > 0) {
+      xlink_context_set_models(&ctx, &ecs[j].models);
+    }
+    /* Encode the bytes */
+    xlink_encoder_write_bytes(&enc, &ecs[j].bytes);
   }
   /* Finalize the bitstream */
   xlink_encoder_finalize(&enc, bs);
   xlink_encoder_clear(&enc);
   xlink_context_clear(&ctx);
-  /* Create a context from code models */
-  xlink_context_init(&ctx, &code->models, capacity, fast, clamp);
-  /* Initialize the decoder with the context and bitstream */
-  xlink_decoder_init(&dec, &ctx, bs);
-  /* Test that decoded code bytes match original input */
-  xlink_decoder_test_bytes(&dec, &code->bytes);
-  /* If the data segment has any bytes */
-  if (xlink_list_length(&data->bytes) > 0) {
-    /* Reset the context with the data models */
-    ctx.models = &data->models;
-    xlink_set_reset(&ctx.matches);
-    /* Test that decoded data bytes match original input */
-    xlink_decoder_test_bytes(&dec, &data->bytes);
+  /* Wait for the decoder to check the rest of the bitstream */
+  pthread_join(thread, NULL);
+  xlink_pipe_clear(&ver.pipe);
+}
+
+typedef struct xlink_pack xlink_pack;
+
+struct xlink_pack {
+  xlink_bitstream bs;
+  xlink_ec_segment *ecs;
+  int necs;
+  int capacity;
+  int hash;
+  int clamp;
+  int paranoid;
+};
+
+void *xlink_pack_segments(void *arg) {
+  xlink_pack *pack;
+  pack = arg;
+  xlink_bitstream_from_segments(&pack->bs, pack->ecs, pack->necs,
+   pack->capacity, pack->hash, pack->clamp, pack->paranoid);
+  return NULL;
+}
+
+/* Add every hash function and clamp combination for a comma separated list
+    of hash table memory sizes, where 0 selects perfect hashing */
+void xlink_binary_add_configs(xlink_binary *bin, const char *sizes) {
+  while (*sizes != '\0') {
+    char *end;
+    int memory;
+    xlink_config config;
+    memory = strtol(sizes, &end, 10);
+    XLINK_ERROR(end == sizes || (*end != ',' && *end != '\0'),
+     ("Invalid -X --evaluate size list %s", sizes));
+    XLINK_ERROR(memory < 0 || memory & 1,
+     ("Specified -X --evaluate size %i must be even", memory));
+    memset(&config, 0, sizeof(xlink_config));
+    config.capacity = memory/2;
+    /* The hash function only matters with replacement hashing */
+    for (config.hash = 0; config.hash <= (memory > 0)*7; config.hash++) {
+      if (XLINK_HASH_CODES[config.hash] == NULL) continue;
+      for (config.clamp = 0; config.clamp <= 1; config.clamp++) {
+        xlink_list_add(&bin->configs, &config);
+      }
+    }
+    sizes = *end == ',' ? end + 1 : end;
   }
-  xlink_decoder_clear(&dec);
-  xlink_context_clear(&ctx);
+}
+
+void xlink_print_configs(xlink_list *configs, int header_size, int bytes) {
+  int i;
+  printf("Evaluated %i configuration(s) in one pass:\n",
+   xlink_list_length(configs));
+  for (i = 0; i < xlink_list_length(configs); i++) {
+    xlink_config *config;
+    int size;
+    config = xlink_list_get(configs, i);
+    size = header_size + (config->bits + 7)/8;
+    if (config->capacity > 0) {
+      printf("  -M %-9i %-2s %-2s %-2s %-2s", 2*config->capacity,
+       config->hash & XLINK_HASH_FAST ? "-L" : "",
+       config->hash & XLINK_HASH_HISTORY ? "-H" : "",
+       config->hash & XLINK_HASH_BUCKET ? "-K" : "",
+       config->clamp ? "-C" : "");
+    }
+    else {
+      printf("  perfect      %-2s %-2s %-2s %-2s", "", "", "",
+       config->clamp ? "-C" : "");
+    }
+    printf(" %i bits, %i bytes -> %2.3lf%% smaller\n", config->bits, size,
+     XLINK_RATIO(size, bytes));
+  }
+}
+
+typedef struct xlink_cpu xlink_cpu;
+
+/* Cycles for each part of the stub decode loop, summed from published
+    instruction timings with typical operands.  Pairing, prefetch and wait
+    states are ignored, so only compare estimates on the same processor. */
+struct xlink_cpu {
+  const char *name;
+  int mhz;
+  /* Splitting the range and walking the models, less the MUL and DIV */
+  int bit;
+  /* Shifting one bitstream bit into the range coder */
+  int input;
+  /* Looking up and updating one model, less the hashing and DIV */
+  int probe;
+  /* Combining one byte into a hash, with IMUL or with ROL when -L --low */
+  int hash[2];
+  int step;
+  int mul;
+  int div;
+  /* Clearing one hash table entry with REP STOSW, or REP STOSD if tagged */
+  int clear;
+  /* Index of the cache line size in xlink_cost, or -1 without a cache */
+  int line;
+  int miss;
+};
+
+static const xlink_cpu XLINK_CPUS[] = {
+  { "386DX-33",    33,  120, 28, 170, { 34, 17 }, 12, 25, 38, 5, -1, 0 },
+  { "486DX2-66",   66,  60,  16, 85,  { 20, 7 },  6,  26, 40, 4, 0,  12 },
+  { "Pentium-100", 100, 35,  12, 45,  { 14, 4 },  3,  10, 41, 1, 1,  20 }
+};
+
+void xlink_print_cost(const xlink_cost *cost, int hash) {
+  int i;
+  printf("Unpack cost: %i bits, %i probes, %i hashes, %i MUL, %i DIV\n",
+   cost->bits, cost->probes, cost->hashes, cost->muls, cost->divs);
+  printf("Hash table lines touched: %i of 16 bytes, %i of 32 bytes\n",
+   cost->lines[0], cost->lines[1]);
+  for (i = 0; i < sizeof(XLINK_CPUS)/sizeof(xlink_cpu); i++) {
+    const xlink_cpu *cpu;
+    double cycles;
+    cpu = &XLINK_CPUS[i];
+    cycles = (double)cost->bits*cpu->bit + (double)cost->input*cpu->input +
+     (double)cost->probes*cpu->probe +
+     (double)cost->hashes*cpu->hash[hash & XLINK_HASH_FAST] +
+     (double)cost->steps*cpu->step + (double)cost->muls*cpu->mul +
+     (double)cost->divs*cpu->div + cost->clears*cpu->clear;
+    if (cpu->line != -1) {
+      cycles += (double)cost->misses[cpu->line]*cpu->miss;
+    }
+    printf("  %-12s %9.1lf M cycles, %6.3lf seconds\n", cpu->name,
+     cycles/1e6, cycles/(cpu->mhz*1e6));
+  }
+}
+
+/* Find the fewest hash table words, up to words, that code the segments within
+    slack bytes of perfect hashing.  Candidates start below the number of
+    distinct contexts and grow by a quarter each step. */
+int xlink_auto_memory(xlink_list **models, xlink_list **bytes, int nsegments,
+ int hash, int clamp, int slack, int words) {
+  xlink_list configs;
+  xlink_config config;
+  xlink_config *perfect;
+  int capacity;
+  int i;
+  xlink_list_init(&configs, sizeof(xlink_config), 0);
+  memset(&config, 0, sizeof(xlink_config));
+  config.hash = hash;
+  config.clamp = clamp;
+  xlink_list_add(&configs, &config);
+  /* Count the distinct contexts with perfect hashing */
+  xlink_evaluate(&configs, models, bytes, nsegments);
+  perfect = xlink_list_get(&configs, 0);
+  printf("Found %i distinct contexts, perfect hashing: %i bytes\n",
+   perfect->contexts, (perfect->bits + 7)/8);
+  config.capacity = XLINK_MAX(256, perfect->contexts/4);
+  for (; config.capacity < words; config.capacity += config.capacity/4) {
+    xlink_list_add(&configs, &config);
+  }
+  config.capacity = words;
+  xlink_list_add(&configs, &config);
+  xlink_evaluate(&configs, models, bytes, nsegments);
+  perfect = xlink_list_get(&configs, 0);
+  capacity = words;
+  for (i = 1; i < xlink_list_length(&configs); i++) {
+    xlink_config *candidate;
+    candidate = xlink_list_get(&configs, i);
+    if ((candidate->bits + 7)/8 <= (perfect->bits + 7)/8 + slack) {
+      capacity = candidate->capacity;
+      break;
+    }
+  }
+  xlink_list_clear(&configs);
+  return capacity;
+}
+
+/* Print the size the segments code to without the buckets of -K --bucket,
+    so that the layouts can be compared */
+void xlink_print_unbucketed(xlink_list **models, xlink_list **bytes,
+ int nsegments, int capacity, int hash, int clamp, int bits) {
+  xlink_list configs;
+  xlink_config config;
+  xlink_config *unbucketed;
+  xlink_list_init(&configs, sizeof(xlink_config), 0);
+  memset(&config, 0, sizeof(xlink_config));
+  config.capacity = capacity;
+  config.hash = hash & ~XLINK_HASH_BUCKET;
+  config.clamp = clamp;
+  xlink_list_add(&configs, &config);
+  xlink_evaluate(&configs, models, bytes, nsegments);
+  unbucketed = xlink_list_get(&configs, 0);
+  printf("Without buckets: %i bits, %i bytes, %+i bytes with buckets\n",
+   unbucketed->bits, (unbucketed->bits + 7)/8,
+   (bits + 7)/8 - (unbucketed->bits + 7)/8);
+  xlink_list_clear(&configs);
+}
+
+static double xlink_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+typedef struct xlink_order xlink_order;
+
+struct xlink_order {
+  /* Candidate order of the segments after the first */
+  xlink_segment **segments;
+  xlink_list *models;
+  xlink_list bytes;
+  xlink_list configs;
+};
+
+void xlink_order_init(xlink_order *order, int nsegments, xlink_list *models) {
+  xlink_config config;
+  order->segments = xlink_malloc(nsegments*sizeof(xlink_segment *));
+  order->models = models;
+  xlink_list_init(&order->bytes, sizeof(unsigned char), 0);
+  xlink_list_init(&order->configs, sizeof(xlink_config), 0);
+  memset(&config, 0, sizeof(xlink_config));
+  xlink_list_add(&order->configs, &config);
+}
+
+void xlink_order_clear(xlink_order *order) {
+  free(order->segments);
+  xlink_list_clear(&order->bytes);
+  xlink_list_clear(&order->configs);
+}
+
+/* Estimate the compressed size of the laid out bytes in bits */
+void *xlink_order_estimate(void *arg) {
+  xlink_order *order;
+  xlink_list *bytes;
+  order = arg;
+  bytes = &order->bytes;
+  xlink_evaluate(&order->configs, &order->models, &bytes, 1);
+  return NULL;
+}
+
+static int xlink_order_bits(xlink_order *order) {
+  return ((xlink_config *)xlink_list_get(&order->configs, 0))->bits;
+}
+
+/* Lay out and relocate the segments in the candidate order, then collect the
+    CODE and DATA bytes.  This changes the shared segments, so only one
+    candidate can be laid out at a time. */
+void xlink_order_layout(xlink_order *order, xlink_binary *bin, int index,
+ int nsegments) {
+  xlink_list ecs;
+  int j;
+  memcpy(&bin->segments[index + 1], order->segments,
+   nsegments*sizeof(xlink_segment *));
+  xlink_binary_layout_segments(bin, index, 0x10010);
+  xlink_apply_relocations(bin->segments + index, bin->nsegments - index);
+  xlink_list_init(&ecs, sizeof(xlink_ec_segment), 0);
+  xlink_binary_extract_segments(bin, index, 0x10010, &ecs);
+  xlink_list_empty(&order->bytes);
+  for (j = 0; j < xlink_list_length(&ecs); j++) {
+    xlink_ec_segment *ec;
+    ec = xlink_list_get(&ecs, j);
+    xlink_list_append(&order->bytes, &ec->bytes);
+    xlink_ec_segment_clear(ec);
+  }
+  xlink_list_clear(&ecs);
+}
+
+/* Reorder the CODE and DATA segments after the first, each within its class,
+    to reduce the estimated compressed size until budget seconds have passed.
+    Every round lays out one random move per worker, then estimates them in
+    parallel with perfect hashing and a fixed set of models. */
+void xlink_binary_order_segments(xlink_binary *bin, int index, double budget) {
+  static const unsigned char MASKS[] = { 0x00, 0x80, 0xc0, 0xe0, 0xf0 };
+  xlink_list models;
+  xlink_order *orders;
+  pthread_t *threads;
+  xlink_segment **best;
+  int first;
+  int nsegments;
+  int ncode;
+  int workers;
+  int rounds;
+  int start;
+  int bits;
+  unsigned int seed;
+  double deadline;
+  int i, k;
+  first = index + 1;
+  for (i = first; i < bin->nsegments; i++) {
+    if (xlink_segment_get_class(bin->segments[i]) != OMF_SEGMENT_CODE) break;
+  }
+  ncode = i - first;
+  for (; i < bin->nsegments; i++) {
+    if (xlink_segment_get_class(bin->segments[i]) != OMF_SEGMENT_DATA) break;
+  }
+  nsegments = i - first;
+  if (ncode < 2 && nsegments - ncode < 2) {
+    return;
+  }
+  deadline = xlink_seconds() + budget;
+  xlink_list_init(&models, sizeof(xlink_model), 0);
+  for (i = 0; i < sizeof(MASKS); i++) {
+    xlink_model model;
+    xlink_model_init(&model, MASKS[i]);
+    xlink_list_add(&models, &model);
+  }
+  xlink_model_set_state(&models, xlink_model_compute_packed_weights(&models));
+  workers = XLINK_MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+  orders = xlink_malloc(workers*sizeof(xlink_order));
+  threads = xlink_malloc(workers*sizeof(pthread_t));
+  for (k = 0; k < workers; k++) {
+    xlink_order_init(&orders[k], nsegments, &models);
+  }
+  best = xlink_malloc(nsegments*sizeof(xlink_segment *));
+  memcpy(best, &bin->segments[first], nsegments*sizeof(xlink_segment *));
+  memcpy(orders[0].segments, best, nsegments*sizeof(xlink_segment *));
+  xlink_order_layout(&orders[0], bin, index, nsegments);
+  xlink_order_estimate(&orders[0]);
+  start = bits = xlink_order_bits(&orders[0]);
+  seed = 1;
+  for (rounds = 0; xlink_seconds() < deadline; rounds++) {
+    int winner;
+    for (k = 0; k < workers; k++) {
+      xlink_segment *seg;
+      int lo, n;
+      int from, to;
+      /* Move one segment to another position within its class */
+      memcpy(orders[k].segments, best, nsegments*sizeof(xlink_segment *));
+      from = rand_r(&seed)%nsegments;
+      lo = from < ncode ? 0 : ncode;
+      n = from < ncode ? ncode : nsegments - ncode;
+      if (n > 1) {
+        to = lo + rand_r(&seed)%n;
+        seg = orders[k].segments[from];
+        if (to < from) {
+          memmove(&orders[k].segments[to + 1], &orders[k].segments[to],
+           (from - to)*sizeof(xlink_segment *));
+        }
+        else {
+          memmove(&orders[k].segments[from], &orders[k].segments[from + 1],
+           (to - from)*sizeof(xlink_segment *));
+        }
+        orders[k].segments[to] = seg;
+      }
+      xlink_order_layout(&orders[k], bin, index, nsegments);
+    }
+    for (k = 1; k < workers; k++) {
+      XLINK_ERROR(
+       pthread_create(&threads[k], NULL, xlink_order_estimate, &orders[k]),
+       ("Unable to create segment order thread"));
+    }
+    xlink_order_estimate(&orders[0]);
+    for (k = 1; k < workers; k++) {
+      pthread_join(threads[k], NULL);
+    }
+    winner = -1;
+    for (k = 0; k < workers; k++) {
+      if (xlink_order_bits(&orders[k]) < bits) {
+        bits = xlink_order_bits(&orders[k]);
+        winner = k;
+      }
+    }
+    if (winner != -1) {
+      memcpy(best, orders[winner].segments,
+       nsegments*sizeof(xlink_segment *));
+    }
+  }
+  /* Leave the best order in place, it is laid out again by the caller */
+  memcpy(&bin->segments[first], best, nsegments*sizeof(xlink_segment *));
+  printf("Ordered %i segments in %i rounds: %i -> %i bytes estimated\n",
+   nsegments, rounds, (start + 7)/8, (bits + 7)/8);
+  for (k = 0; k < workers; k++) {
+    xlink_order_clear(&orders[k]);
+  }
+  free(orders);
+  free(threads);
+  free(best);
+  xlink_list_clear(&models);
 }
 
 void xlink_binary_load_modules(xlink_binary *bin) {
@@ -1835,7 +2778,9 @@ void xlink_binary_load_stub(xlink_binary *bin, const char *stub) {
       break;
     }
   }
-  XLINK_ERROR(mod == NULL, ("Stub %s not found", stub));
+  /* The timed stubs end in d and are only built by make time */
+  XLINK_ERROR(mod == NULL, ("Stub %s not found%s", stub,
+   stub[strlen(stub) - 1] == 'd' ? ", -D --time needs make time" : ""));
 }
 
 xlink_segment *xlink_binary_find_segment_by_public(xlink_binary *bin,
@@ -1879,27 +2824,102 @@ void xlink_binary_write_com(xlink_binary *bin, int nsegments) {
   fclose(out);
 }
 
-xlink_reloc *xlink_segment_find_reloc(xlink_segment *seg, const char *name) {
-  xlink_reloc *ret;
+/* Bytes the stubs allocate before the hash table for each cache indexed by
+    model, the slots found for the bit being decoded with -S --speed and the
+    history hashes with -H --history */
+#define XLINK_CACHE (0x40000)
+
+/* The hash function selected by -L --low, -H --history and -K --bucket, as an
+    index into XLINK_HASH_CODES */
+int xlink_flags_hash(unsigned int flags) {
+  return (flags & MOD_LOW ? XLINK_HASH_FAST : 0) |
+   (flags & MOD_HISTORY ? XLINK_HASH_HISTORY : 0) |
+   (flags & MOD_BUCKET ? XLINK_HASH_BUCKET : 0);
+}
+
+/* Number of hash table entries the stub indexes in the memory it allocates,
+    2 bytes each or 4 bytes with a tag for -T --tag, rounded down to whole
+    buckets of 16 entries for -K --bucket and to a power of two for the
+    masking of -S --speed */
+int xlink_binary_hash_table_words(xlink_binary *bin, unsigned int flags) {
+  int words;
+  words = bin->hash_table_memory/(flags & MOD_TAG ? 4 : 2);
+  if (flags & MOD_BUCKET) {
+    words &= ~15;
+  }
+  if (flags & MOD_SPEED) {
+    while (words & (words - 1)) {
+      words &= words - 1;
+    }
+  }
+  return words;
+}
+
+/* Bytes of the hash table entries the stub indexes, which is less than the
+    -M --memory size when the entries are rounded down */
+int xlink_binary_hash_table_bytes(xlink_binary *bin, unsigned int flags) {
+  return (flags & MOD_TAG ? 4 : 2)*xlink_binary_hash_table_words(bin, flags);
+}
+
+/* Number of 64kB blocks of memory the stub allocates, for the entries it
+    indexes and the caches before them */
+int xlink_binary_hash_table_segs(xlink_binary *bin, unsigned int flags) {
+  return (xlink_binary_hash_table_bytes(bin, flags) +
+   (flags & MOD_SPEED ? XLINK_CACHE : 0) +
+   (flags & MOD_HISTORY ? XLINK_CACHE : 0) + 65535)/65536;
+}
+
+/* Most instructions the stub may run before it is assumed to be stuck */
+#define XLINK_RUN_LIMIT (10000000000LL)
+
+/* Run the packed COM file in the x86 interpreter until the stub returns to
+    the unpacked program at 10010h, then compare it with payload */
+void xlink_binary_run(xlink_binary *bin, unsigned int flags,
+ xlink_list *payload) {
+  xlink_file file;
+  xlink_x86 cpu;
+  double start;
   int i;
-  ret = NULL;
-  for (i = 1; i <= seg->nrelocs; i++) {
-    xlink_reloc *rel;
-    rel = xlink_segment_get_reloc(seg, i);
-    if (rel->target == OMF_TARGET_EXT) {
-      xlink_extern *ext;
-      ext = xlink_module_get_extern(seg->module, rel->target_idx);
-      if (strcmp(ext->name, name) == 0) {
-        XLINK_ERROR(ret != NULL,
-         ("Duplicate relocation definition found for name %s in %s", name,
-         seg->module->filename));
-        ret = rel;
-        break;
+  xlink_file_init(&file, bin->output);
+  xlink_x86_init(&cpu,
+   XLINK_X86_HEAP + 65536*(xlink_binary_hash_table_segs(bin, flags) + 1));
+  xlink_x86_load_com(&cpu, file.buf, file.size);
+  start = xlink_seconds();
+  XLINK_ERROR(!xlink_x86_run(&cpu, 0x10010, XLINK_RUN_LIMIT),
+   ("Stub %s after %lli instructions without reaching 10010h",
+   cpu.exited ? "exited" : "still running", cpu.instructions));
+  for (i = 0; i < xlink_list_length(payload); i++) {
+    unsigned char byte;
+    byte = cpu.mem[cpu.bases[XLINK_X86_CS] + 0x10010 + i];
+    XLINK_ERROR(byte != *xlink_list_get_byte(payload, i),
+     ("Unpacked byte %04x differs, %02X != %02X", 0x10010 + i, byte,
+     *xlink_list_get_byte(payload, i)));
+  }
+  printf("Unpacked %i bytes in %lli instructions, %lli reads, %lli writes "
+   "(%.2lfs)\n", xlink_list_length(payload), cpu.instructions, cpu.reads,
+   cpu.writes, xlink_seconds() - start);
+  xlink_x86_clear(&cpu);
+  xlink_file_clear(&file);
+}
+
+/* The first relocation in seg to the extern name */
+xlink_reloc *xlink_segment_find_reloc(xlink_segment *seg, const char *name) {
+  xlink_symbol *sym;
+  if (xlink_index_stale(&seg->reloc_index, seg->nrelocs)) {
+    int i;
+    for (i = 1; i <= seg->nrelocs; i++) {
+      xlink_reloc *rel;
+      rel = xlink_segment_get_reloc(seg, i);
+      if (rel->target == OMF_TARGET_EXT) {
+        xlink_extern *ext;
+        ext = xlink_module_get_extern(seg->module, rel->target_idx);
+        xlink_index_add(&seg->reloc_index, ext->name, rel);
       }
     }
   }
-  XLINK_ERROR(ret == NULL, ("No relocation found for extern name %s", name));
-  return ret;
+  sym = xlink_index_get(&seg->reloc_index, name);
+  XLINK_ERROR(sym == NULL, ("No relocation found for extern name %s", name));
+  return sym->value;
 }
 
 unsigned char xlink_binary_get_relative_byte(xlink_binary *bin,
@@ -1954,7 +2974,9 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
   xlink_segment *start;
   xlink_segment *main;
   xlink_segment *prog;
+  xlink_list payload;
   int s;
+  xlink_list_init(&payload, sizeof(unsigned char), 0);
   /* Stage -1: Load all modules */
   xlink_binary_load_modules(bin);
   /* Stage 0: Find the entry point segment */
@@ -1970,52 +2992,16 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
      ("Only 32-bit programs can be packed, %s is 16-bit", bin->entry));
   }
   else {
+    char name[20];
     char *stub;
     if (flags & MOD_PACK) {
-      if (flags & MOD_CLAMP) {
-        if (flags & MOD_LOW) {
-          if (flags & MOD_BASE) {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pcfbi" : "stub32pcfb";
-          }
-          else {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pcfi" : "stub32pcf";
-          }
-        }
-        else {
-          if (flags & MOD_BASE) {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pcbi" : "stub32pcb";
-          }
-          else {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pci" : "stub32pc";
-          }
-        }
-      }
-      else {
-        if (flags & MOD_LOW) {
-          if (flags & MOD_BASE) {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pfbi" : "stub32pfb";
-          }
-          else {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pfi" : "stub32pf";
-          }
-        }
-        else {
-          if (flags & MOD_BASE) {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pbi" : "stub32pb";
-          }
-          else {
-            /* Load the 32-bit unpacking stub */
-            stub = bin->init ? "stub32pi" : "stub32p";
-          }
-        }
-      }
+      /* Load the 32-bit unpacking stub, named by its options in order */
+      sprintf(name, "stub32p%s%s%s%s%s%s%s%s%s", flags & MOD_CLAMP ? "c" : "",
+       flags & MOD_LOW ? "f" : "", flags & MOD_TAG ? "t" : "",
+       flags & MOD_SPEED ? "s" : "", flags & MOD_HISTORY ? "h" : "",
+       flags & MOD_BUCKET ? "k" : "", flags & MOD_BASE ? "b" : "",
+       bin->init ? "i" : "", flags & MOD_TIME ? "d" : "");
+      stub = name;
     }
     else {
       if (flags & MOD_EXIT) {
@@ -2043,7 +3029,7 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
     start = xlink_binary_find_segment_by_public(bin, stub, OMF_SEGMENT_CODE);
     /* If there is an external init_ function, find and rewrite it */
     if (bin->init) {
-      strcpy(xlink_module_find_extern(start->module, "init_")->name, bin->init);
+      xlink_module_rename_extern(start->module, "init_", bin->init);
     }
     if (flags & MOD_PACK) {
       prog =
@@ -2051,7 +3037,7 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
     }
     else {
       /* The stub code calls an external main_ function, find and rewrite it */
-      strcpy(xlink_module_find_extern(start->module, "main_")->name, bin->entry);
+      xlink_module_rename_extern(start->module, "main_", bin->entry);
     }
   }
   /* Stage 1: Resolve all symbol references, starting from start */
@@ -2080,13 +3066,21 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
   /* Stage 4: Apply relocations to the program segments */
   xlink_apply_relocations(bin->segments, s);
   if (flags & MOD_PACK) {
-    int data_idx;
-    int offset;
-    xlink_ec_segment code;
-    xlink_ec_segment data;
+    xlink_list ec_list;
+    xlink_ec_segment *ecs;
+    int necs;
+    int stride;
+    int headers;
+    int length;
+    xlink_pack perfect;
+    pthread_t thread;
+    xlink_list **segment_models;
+    xlink_list **segment_bytes;
+    xlink_cost cost;
     unsigned char byte;
     xlink_bitstream bs;
     int size;
+    int j;
     if (flags & MOD_BASE) {
       xlink_segment *base;
       base =
@@ -2097,7 +3091,7 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
     /* Stage 4: Resolve all symbol references, starting from 32-bit entry */
     xlink_binary_link_root_segment(bin, main);
     /* Stage 5: Sort segments by class (CODE, DATA, BSS) */
-    xlink_sort_segments(bin->segments + s, bin->nsegments - s, &data_idx, NULL);
+    xlink_sort_segments(bin->segments + s, bin->nsegments - s, NULL, NULL);
     /* Stage 5a: Set main as the first CODE segment */
     xlink_set_first_segment(&bin->segments[s], main);
     if (flags & MOD_BASE) {
@@ -2109,101 +3103,178 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
       base->start = 0x10000;
       s++;
     }
+    if (flags & MOD_FOLD) {
+      /* Stage 5b: Fold identical segments into a single copy */
+      xlink_binary_fold_segments(bin, s);
+    }
+    if (flags & MOD_ORDER) {
+      /* Stage 5c: Reorder segments to reduce the estimated compressed size */
+      xlink_binary_order_segments(bin, s, bin->order_budget);
+    }
     /* Stage 6: Lay segments in memory with alignment starting at 10010h */
     xlink_binary_layout_segments(bin, s, 0x10010);
     /* Stage 7: Apply relocations to the payload program segments */
     xlink_apply_relocations(bin->segments + s, bin->nsegments - s);
-    /* Stage 8: Extract the CODE and DATA segments */
-    xlink_ec_segment_init(&code);
-    xlink_ec_segment_init(&data);
-    offset = xlink_binary_extract_class(bin, s + 0, 0x10010, OMF_SEGMENT_CODE,
-     &code.bytes);
-    offset = xlink_binary_extract_class(bin, s + data_idx, offset,
-     OMF_SEGMENT_DATA, &data.bytes);
+    /* Stage 8: Extract the CODE and DATA segments into EC segments */
+    xlink_list_init(&ec_list, sizeof(xlink_ec_segment), 0);
+    xlink_binary_extract_segments(bin, s, 0x10010, &ec_list);
+    ecs = (xlink_ec_segment *)ec_list.data;
     if (flags & MOD_ONE) {
-      /* If only one EC segment, append the data.bytes to code.bytes */
-      xlink_list_append(&code.bytes, &data.bytes);
-      xlink_list_empty(&data.bytes);
-    }
-    printf("code bytes = %i\n", xlink_list_length(&code.bytes));
-    printf("data bytes = %i\n", xlink_list_length(&data.bytes));
-    /* Stage 9: Search for the best context to use for CODE segment bytes */
-    xlink_model_search(&code.models, &code.bytes);
-    code.header_size = xlink_header_length(&code.models);
-    code.state = xlink_model_compute_packed_weights(&code.models);
-    if (xlink_list_length(&data.bytes) > 0) {
-      /* State 9a: Search for the best context to use for DATA segment bytes */
-      xlink_model_search(&data.models, &data.bytes);
-      data.header_size = xlink_header_length(&data.models);
-      data.state = xlink_model_compute_packed_weights(&data.models);
-    }
-    byte = xlink_binary_get_relative_byte(bin, prog, -code.header_size);
-    /* Set the parity of the CODE and DATA state based on byte */
-    if (xlink_list_length(&data.bytes) == 0) {
-      if (xlink_parity(byte) == xlink_parity(code.state & 0xff)) {
-        code.state ^= 1;
+      /* If only one EC segment, append the rest of the bytes to the first */
+      for (j = 1; j < xlink_list_length(&ec_list); j++) {
+        xlink_list_append(&ecs[0].bytes, &ecs[j].bytes);
+        xlink_ec_segment_clear(&ecs[j]);
       }
+      ec_list.length = 1;
     }
-    else {
-      if (xlink_parity(byte) != xlink_parity(code.state & 0xff)) {
-        code.state ^= 1;
+    necs = xlink_list_length(&ec_list);
+    for (j = 0; j < necs; j++) {
+      printf("EC segment %i bytes = %i\n", j, xlink_list_length(&ecs[j].bytes));
+    }
+    if (flags & MOD_AUTO_ONE && necs == 2) {
+      /* Stage 9: Search for the best contexts and number of EC segments */
+      if (xlink_search_layouts(&ecs[0], &ecs[1], &bin->budget)) {
+        xlink_ec_segment_clear(&ecs[1]);
+        ec_list.length = necs = 1;
       }
-      if (xlink_parity(byte) == xlink_parity(data.state & 0xff)) {
-        data.state ^= 1;
+      else {
+        xlink_search_segments(ecs, necs, &bin->budget);
       }
     }
-    /* Update the model states based on the segment states */
-    xlink_model_set_state(&code.models, code.state);
-    xlink_model_set_state(&data.models, data.state);
-    /* Stage 10: Compress the CODE and DATA segments with perfect hashing */
-    xlink_bitstream_from_segments(&bs, &code, &data, 0, flags & MOD_LOW,
-     flags & MOD_CLAMP);
-    size = code.header_size + data.header_size + (bs.bits + 7)/8;
-    printf("Perfect hashing: %i bits, %i bytes\n", bs.bits, (bs.bits + 7)/8);
+    else {
+      /* Stage 9: Search for the best contexts, one EC segment per thread */
+      xlink_search_segments(ecs, necs, &bin->budget);
+    }
+    /* Every header but the last is padded to the stride the stub steps by */
+    stride = 0;
+    for (j = 0; j < necs; j++) {
+      ecs[j].header_size = xlink_header_length(&ecs[j].models);
+      ecs[j].state = xlink_model_compute_packed_weights(&ecs[j].models);
+      if (j < necs - 1 || necs == 1) {
+        stride = XLINK_MAX(stride, ecs[j].header_size);
+      }
+    }
+    headers = length = 0;
+    for (j = 0; j < necs; j++) {
+      if (j < necs - 1 || necs == 1) {
+        ecs[j].header_size = stride;
+      }
+      headers += ecs[j].header_size;
+      length += xlink_list_length(&ecs[j].bytes);
+    }
+    byte = xlink_binary_get_relative_byte(bin, prog, -stride);
+    /* Set the parity of each state based on byte so that the stub continues
+        after every EC segment but the last */
+    for (j = 0; j < necs; j++) {
+      if ((xlink_parity(byte) == xlink_parity(ecs[j].state & 0xff)) ==
+       (j == necs - 1)) {
+        ecs[j].state ^= 1;
+      }
+      /* Update the model states based on the segment states */
+      xlink_model_set_state(&ecs[j].models, ecs[j].state);
+    }
+    /* Stage 10: Compress the EC segments with perfect hashing, only to report
+        its size, while the replacement hashing output is made */
+    perfect.ecs = ecs;
+    perfect.necs = necs;
+    perfect.capacity = 0;
+    perfect.hash = xlink_flags_hash(flags);
+    perfect.clamp = flags & MOD_CLAMP;
+    perfect.paranoid = flags & MOD_PARANOID;
+    XLINK_ERROR(pthread_create(&thread, NULL, xlink_pack_segments, &perfect),
+     ("Unable to create perfect hashing thread"));
+    segment_models = xlink_malloc(necs*sizeof(xlink_list *));
+    segment_bytes = xlink_malloc(necs*sizeof(xlink_list *));
+    for (j = 0; j < necs; j++) {
+      segment_models[j] = &ecs[j].models;
+      segment_bytes[j] = &ecs[j].bytes;
+    }
+    if (flags & (MOD_EVALUATE | MOD_AUTO_MEMORY)) {
+      if (flags & MOD_EVALUATE) {
+        xlink_evaluate(&bin->configs, segment_models, segment_bytes, necs);
+        xlink_print_configs(&bin->configs, headers, length);
+      }
+      if (flags & MOD_AUTO_MEMORY) {
+        int words;
+        /* Stage 9b: Size the hash table the stub allocates and clears */
+        words = xlink_auto_memory(segment_models, segment_bytes, necs,
+         xlink_flags_hash(flags), flags & MOD_CLAMP, bin->auto_memory,
+         xlink_binary_hash_table_words(bin, flags));
+        if (flags & MOD_BUCKET) {
+          /* Round up to whole buckets of 16 entries */
+          words = (words + 15) & ~15;
+        }
+        if (flags & MOD_SPEED) {
+          /* Round up to the power of two the -S --speed stub masks with */
+          while (words & (words - 1)) {
+            words += words & -words;
+          }
+        }
+        bin->hash_table_memory = (flags & MOD_TAG ? 4 : 2)*words;
+        printf("Using hash table memory = %i\n", bin->hash_table_memory);
+      }
+    }
+    if (xlink_binary_hash_table_bytes(bin, flags) < bin->hash_table_memory) {
+      printf("Using hash table memory = %i of -M --memory %i\n",
+       xlink_binary_hash_table_bytes(bin, flags), bin->hash_table_memory);
+    }
+    /* Stage 10: Compress the EC segments with replacement hashing */
+    xlink_bitstream_from_segments(&bs, ecs, necs,
+     xlink_binary_hash_table_words(bin, flags), xlink_flags_hash(flags),
+     flags & MOD_CLAMP, flags & MOD_PARANOID);
+    pthread_join(thread, NULL);
+    size = headers + (perfect.bs.bits + 7)/8;
+    printf("Perfect hashing: %i bits, %i bytes\n", perfect.bs.bits,
+     (perfect.bs.bits + 7)/8);
     printf("Compressed size: %i bytes -> %2.3lf%% smaller\n", size,
-     XLINK_RATIO(size, code.bytes.length + data.bytes.length));
-    xlink_bitstream_clear(&bs);
-    /* Stage 10: Compress the CODE and DATA segments with replacement hashing */
-    xlink_bitstream_from_segments(&bs, &code, &data, bin->hash_table_memory/2,
-     flags & MOD_LOW, flags & MOD_CLAMP);
-    size = code.header_size + data.header_size + (bs.bits + 7)/8;
+     XLINK_RATIO(size, length));
+    xlink_bitstream_clear(&perfect.bs);
+    size = headers + (bs.bits + 7)/8;
     printf("Replacement hashing: %i bits, %i bytes\n", bs.bits, (bs.bits + 7)/8);
     printf("Compressed size: %i bytes -> %2.3lf%% smaller\n", size,
-     XLINK_RATIO(size, code.bytes.length + data.bytes.length));
+     XLINK_RATIO(size, length));
+    if (flags & MOD_BUCKET) {
+      /* Stage 10b: Compare with the table layout without buckets */
+      xlink_print_unbucketed(segment_models, segment_bytes, necs,
+       xlink_binary_hash_table_words(bin, flags), xlink_flags_hash(flags),
+       flags & MOD_CLAMP, bs.bits);
+    }
+    /* Stage 10a: Estimate the time the stub takes to unpack */
+    xlink_cost_segments(&cost, segment_models, segment_bytes, necs,
+     xlink_binary_hash_table_words(bin, flags), xlink_flags_hash(flags),
+     flags & MOD_TAG, flags & MOD_SPEED, bs.bits);
+    xlink_print_cost(&cost, xlink_flags_hash(flags));
+    free(segment_models);
+    free(segment_bytes);
     /* Write payload into the prog segment data */
     {
+      int offset;
+      int end;
       int i;
-      xlink_binary_set_public_offset(bin, "ec_bits",
-       code.header_size + data.header_size);
+      xlink_binary_set_public_offset(bin, "ec_bits", headers);
       /* Need to allocate space for the ec_segs header and ec_bits data */
       XLINK_ERROR(size > prog->length,
        ("Compressed binary data %i larger than reserved PROG space %i", size,
        prog->length));
-      prog->length = code.header_size + data.header_size + (bs.bits + 7)/8;
+      prog->length = headers + (bs.bits + 7)/8;
       printf("prog->length = %i\n", prog->length);
       prog->data = xlink_malloc(prog->length);
       prog->info |= SEG_HAS_DATA;
-      ((unsigned int *)prog->data)[0] =
-       0xFFFEFFF0 - code.bytes.length;
-      ((unsigned int *)prog->data)[1] = code.state;
-      for (i = 0; i < xlink_list_length(&code.models); i++) {
-        xlink_model *model;
-        model = xlink_list_get(&code.models, i);
-        prog->data[8 + i] = model->mask;
-      }
-      if (xlink_list_length(&data.bytes) > 0) {
-        ((unsigned int *)&prog->data[code.header_size])[0] =
-         0xFFFEFFF0 - code.bytes.length - data.bytes.length;
-        ((unsigned int *)&prog->data[code.header_size])[1] = data.state;
-        for (i = 0; i < xlink_list_length(&data.models); i++) {
+      /* Write the chained EC segment headers, padding is left as zeros */
+      offset = end = 0;
+      for (j = 0; j < necs; j++) {
+        end += xlink_list_length(&ecs[j].bytes);
+        ((unsigned int *)&prog->data[offset])[0] = 0xFFFEFFF0 - end;
+        ((unsigned int *)&prog->data[offset])[1] = ecs[j].state;
+        for (i = 0; i < xlink_list_length(&ecs[j].models); i++) {
           xlink_model *model;
-          model = xlink_list_get(&data.models, i);
-          prog->data[code.header_size + 8 + i] = model->mask;
+          model = xlink_list_get(&ecs[j].models, i);
+          prog->data[offset + 8 + i] = model->mask;
         }
+        offset += ecs[j].header_size;
       }
-      xlink_bitstream_copy_bits(&bs, prog->data,
-       (code.header_size + data.header_size)*8);
-      printf("ec_bits->offset = %i\n", code.header_size + data.header_size);
+      xlink_bitstream_copy_bits(&bs, prog->data, headers*8);
+      printf("ec_bits->offset = %i\n", headers);
     }
     xlink_bitstream_clear(&bs);
     /* Fix up the compressing stub */
@@ -2211,32 +3282,38 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
       xlink_reloc *ec_segs;
       xlink_public *header;
       xlink_binary_set_public_offset(bin, "hash_table_segs",
-       (bin->hash_table_memory + 65535)/65536);
+       xlink_binary_hash_table_segs(bin, flags));
       xlink_binary_set_public_offset(bin, "hash_table_words",
-       bin->hash_table_memory/2);
+       xlink_binary_hash_table_words(bin, flags));
       ec_segs = xlink_segment_find_reloc(start, "ec_segs");
-      ec_segs->addend.offset = -code.header_size;
+      ec_segs->addend.offset = -stride;
       /* Apply relocations again to put the fixups into effect */
       xlink_apply_relocations(bin->segments, s);
-      if (!bin->init) {
+      /* The timed stub links the print routines in before ec_segs, so it
+          stores the hash table address as the init stub does */
+      if (!bin->init && !(flags & MOD_TIME)) {
         xlink_public *heap;
         heap = xlink_binary_find_public(bin, "XLINK_heap_offset");
-        start->data[heap->offset] += code.header_size;
+        start->data[heap->offset] += stride;
       }
       header = xlink_binary_find_public(bin, "XLINK_header_size");
-      start->data[header->offset] = code.header_size;
+      start->data[header->offset] = stride;
       XLINK_ERROR(
-       byte != xlink_binary_get_relative_byte(bin, prog, -code.header_size),
+       byte != xlink_binary_get_relative_byte(bin, prog, -stride),
        ("Parity byte %i modified after relocation, %02X != %02X",
-       code.header_size, byte,
-       xlink_binary_get_relative_byte(bin, prog, -code.header_size)));
+       stride, byte, xlink_binary_get_relative_byte(bin, prog, -stride)));
       if (!xlink_parity(byte)) {
         /* Flip the direction of branch after segment done */
         start->data[header->offset + 1] ^= 1;
       }
     }
-    xlink_ec_segment_clear(&code);
-    xlink_ec_segment_clear(&data);
+    for (j = 0; j < necs; j++) {
+      if (flags & MOD_RUN) {
+        xlink_list_append(&payload, &ecs[j].bytes);
+      }
+      xlink_ec_segment_clear(&ecs[j]);
+    }
+    xlink_list_clear(&ec_list);
   }
   /* Optionally write the map file. */
   if (bin->map != NULL) {
@@ -2244,9 +3321,146 @@ void xlink_binary_link(xlink_binary *bin, unsigned int flags) {
   }
   /* Stage 5: Write the COM file to disk a segment at a time */
   xlink_binary_write_com(bin, s);
+  if (flags & MOD_RUN) {
+    /* Optionally check that the stub unpacks the payload it was given */
+    xlink_binary_run(bin, flags, &payload);
+  }
+  xlink_list_clear(&payload);
+}
+
+typedef struct xlink_tune xlink_tune;
+
+struct xlink_tune {
+  unsigned int flags;
+  pid_t pid;
+  char output[256];
+  char map[256];
+  double start;
+  double time;
+  /* Size of the output file, or -1 if linking failed */
+  int size;
+};
+
+int tune_comp(const void *a, const void *b) {
+  const xlink_tune *tune_a;
+  const xlink_tune *tune_b;
+  tune_a = (xlink_tune *)a;
+  tune_b = (xlink_tune *)b;
+  /* Sort failed links last, then on size and time ascending */
+  if ((tune_a->size < 0) != (tune_b->size < 0)) {
+    return tune_a->size < 0 ? 1 : -1;
+  }
+  if (tune_a->size != tune_b->size) {
+    return tune_a->size - tune_b->size;
+  }
+  return (tune_a->time > tune_b->time) - (tune_a->time < tune_b->time);
+}
+
+/* The -1, -L and -C flags are adjacent bits, counted through from MOD_ONE */
+#define XLINK_TUNE_FLAGS (MOD_ONE | MOD_LOW | MOD_CLAMP)
+
+/* Link every combination of -1, -L and -C in parallel worker processes, since
+    a failed link exits, and keep the smallest output */
+void xlink_binary_tune(xlink_binary *bin, unsigned int flags) {
+  xlink_tune tunes[XLINK_TUNE_FLAGS/MOD_ONE + 1];
+  int ntunes;
+  int workers;
+  int running;
+  int i, j;
+  ntunes = sizeof(tunes)/sizeof(xlink_tune);
+  workers = XLINK_MAX(1, sysconf(_SC_NPROCESSORS_ONLN));
+  for (i = 0; i < ntunes; i++) {
+    xlink_tune *tune;
+    tune = &tunes[i];
+    tune->flags = (flags & ~(MOD_TUNE | XLINK_TUNE_FLAGS)) | i*MOD_ONE;
+    sprintf(tune->output, "%.200s.tune%i", bin->output, i);
+    tune->map[0] = '\0';
+    if (bin->map != NULL) {
+      sprintf(tune->map, "%.200s.tune%i", bin->map, i);
+    }
+  }
+  printf("Tuning %i combinations with %i worker(s)... ", ntunes, workers);
+  fflush(stdout);
+  running = 0;
+  for (i = j = 0; j < ntunes; ) {
+    if (i < ntunes && running < workers) {
+      xlink_tune *tune;
+      tune = &tunes[i++];
+      tune->start = xlink_seconds();
+      tune->pid = fork();
+      XLINK_ERROR(tune->pid < 0, ("Unable to fork tuning worker"));
+      if (tune->pid == 0) {
+        XLINK_ERROR(freopen("/dev/null", "w", stdout) == NULL,
+         ("Unable to redirect tuning worker output"));
+        bin->output = tune->output;
+        if (bin->map != NULL) {
+          bin->map = tune->map;
+        }
+        xlink_binary_link(bin, tune->flags);
+        exit(EXIT_SUCCESS);
+      }
+      running++;
+    }
+    else {
+      int status;
+      pid_t pid;
+      int k;
+      pid = wait(&status);
+      XLINK_ERROR(pid < 0, ("Unable to wait for tuning worker"));
+      for (k = 0; k < i; k++) {
+        xlink_tune *tune;
+        tune = &tunes[k];
+        if (tune->pid == pid) {
+          struct stat st;
+          tune->time = xlink_seconds() - tune->start;
+          tune->size = -1;
+          if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS &&
+           stat(tune->output, &st) == 0) {
+            tune->size = st.st_size;
+          }
+        }
+      }
+      running--;
+      j++;
+    }
+  }
+  printf("done\n");
+  qsort(tunes, ntunes, sizeof(xlink_tune), tune_comp);
+  XLINK_ERROR(tunes[0].size < 0, ("Every tuning combination failed to link"));
+  printf("Rank  Flags          Size      Time\n");
+  for (i = 0; i < ntunes; i++) {
+    xlink_tune *tune;
+    tune = &tunes[i];
+    printf("%4i  -p%-3s%-3s%-3s%-3s", i + 1, tune->flags & MOD_ONE ? " -1" : "",
+     tune->flags & MOD_LOW ? " -L" : "", tune->flags & MOD_CLAMP ? " -C" : "",
+     tune->flags & MOD_BASE ? " -B" : "");
+    if (tune->size < 0) {
+      printf("  %8s  %7.2lfs\n", "failed", tune->time);
+    }
+    else {
+      printf("  %8i  %7.2lfs\n", tune->size, tune->time);
+    }
+  }
+  /* Keep the smallest output and remove the rest */
+  for (i = 0; i < ntunes; i++) {
+    if (i == 0) {
+      XLINK_ERROR(rename(tunes[i].output, bin->output) != 0,
+       ("Unable to rename '%s' to '%s'", tunes[i].output, bin->output));
+      if (bin->map != NULL) {
+        XLINK_ERROR(rename(tunes[i].map, bin->map) != 0,
+         ("Unable to rename '%s' to '%s'", tunes[i].map, bin->map));
+      }
+    }
+    else {
+      remove(tunes[i].output);
+      if (bin->map != NULL) {
+        remove(tunes[i].map);
+      }
+    }
+  }
 }
 
-const char *OPTSTRING = "o:e:i:pC1LEBM:smdch";
+const char *OPTSTRING = "o:e:i:pC1ag:O:FrDTSHKLEBPM:A:X:W:Y:tsmdch";
 
 const struct option OPTIONS[] = {
   { "output", required_argument, NULL, 'o' },
@@ -2254,11 +3468,27 @@ const struct option OPTIONS[] = {
   { "init", required_argument,   NULL, 'i' },
   { "pack", no_argument,         NULL, 'p' },
   { "one", no_argument,          NULL, '1' },
+  { "auto-one", no_argument,     NULL, 'a' },
+  { "group", required_argument,  NULL, 'g' },
+  { "order", required_argument,  NULL, 'O' },
+  { "fold", no_argument,         NULL, 'F' },
+  { "run", no_argument,          NULL, 'r' },
+  { "time", no_argument,         NULL, 'D' },
+  { "tag", no_argument,          NULL, 'T' },
+  { "speed", no_argument,        NULL, 'S' },
+  { "history", no_argument,      NULL, 'H' },
+  { "bucket", no_argument,       NULL, 'K' },
   { "low", no_argument,          NULL, 'L' },
   { "clamp", no_argument,        NULL, 'C' },
   { "exit", no_argument,         NULL, 'E' },
   { "base", no_argument,         NULL, 'B' },
+  { "paranoid", no_argument,     NULL, 'P' },
   { "memory", required_argument, NULL, 'M' },
+  { "auto-memory", required_argument, NULL, 'A' },
+  { "evaluate", required_argument, NULL, 'X' },
+  { "weigh", required_argument,  NULL, 'W' },
+  { "max-models", required_argument, NULL, 'Y' },
+  { "tune", no_argument,         NULL, 't' },
   { "split", no_argument,        NULL, 's' },
   { "map", no_argument,          NULL, 'm' },
   { "dump", no_argument,         NULL, 'd' },
@@ -2275,11 +3505,27 @@ static void usage(const char *argv0) {
    "  -i --init <function>            Optional 16-bit initialization routine.\n"
    "  -p --pack                       Create a compressed binary.\n"
    "  -1 --one                        Use only one EC segment with -p --pack.\n"
+   "  -a --auto-one                   Use -1 --one when estimated smaller.\n"
+   "  -g --group <segment>            Start a new EC segment at segment.\n"
+   "  -O --order <seconds>            Reorder segments to compress better.\n"
+   "  -F --fold                       Fold identical CODE segments.\n"
+   "  -r --run                        Run the stub to verify it unpacks.\n"
+   "  -D --time                       Time each unpack phase (make time).\n"
+   "  -T --tag                        Tag entries, skip per-segment clears.\n"
+   "  -S --speed                      Faster stub with a power of two table.\n"
+   "  -H --history                    Hash the history once for each byte.\n"
+   "  -K --bucket                     Keep the counts for a nibble together.\n"
    "  -L --low                        Use low complexity hashing function.\n"
    "  -C --clamp                      Clamp raw count at 255 (adds 5 bytes).\n"
    "  -E --exit                       Program will explicitly call exit().\n"
    "  -B --base                       Compute and export XLINK_base symbol.\n"
+   "  -P --paranoid                   Verify by decoding with the full model.\n"
    "  -M --memory <size>              Hash table memory size (default: 12MB).\n"
+   "  -A --auto-memory <bytes>        Shrink -M to within bytes of perfect.\n"
+   "  -X --evaluate <size,...>        Size all hash and -C choices at once.\n"
+   "  -W --weigh <bits>               Charge bits per 1000 unpack hash probes.\n"
+   "  -Y --max-models <count>         Search for at most count models.\n"
+   "  -t --tune                       Pack with the best of -1, -L and -C.\n"
    "  -m --map                        Generate a linker map file.\n"
    "  -d --dump                       Dump module contents only.\n"
    "  -s --split                      Split segments into linkable pieces.\n"
@@ -2318,6 +3564,47 @@ int main(int argc, char *argv[]) {
         flags |= MOD_ONE;
         break;
       }
+      case 'a' : {
+        flags |= MOD_AUTO_ONE;
+        break;
+      }
+      case 'g' : {
+        xlink_list_add(&bin.groups, &optarg);
+        break;
+      }
+      case 'O' : {
+        flags |= MOD_ORDER;
+        bin.order_budget = atof(optarg);
+        break;
+      }
+      case 'F' : {
+        flags |= MOD_FOLD;
+        break;
+      }
+      case 'r' : {
+        flags |= MOD_RUN;
+        break;
+      }
+      case 'D' : {
+        flags |= MOD_TIME;
+        break;
+      }
+      case 'T' : {
+        flags |= MOD_TAG;
+        break;
+      }
+      case 'S' : {
+        flags |= MOD_SPEED;
+        break;
+      }
+      case 'H' : {
+        flags |= MOD_HISTORY;
+        break;
+      }
+      case 'K' : {
+        flags |= MOD_BUCKET;
+        break;
+      }
       case 'L' : {
         flags |= MOD_LOW;
         break;
@@ -2334,10 +3621,38 @@ int main(int argc, char *argv[]) {
         flags |= MOD_BASE;
         break;
       }
+      case 'P' : {
+        flags |= MOD_PARANOID;
+        break;
+      }
       case 'M' : {
         bin.hash_table_memory = atoi(optarg);
         break;
       }
+      case 'A' : {
+        flags |= MOD_AUTO_MEMORY;
+        bin.auto_memory = atoi(optarg);
+        break;
+      }
+      case 't' : {
+        flags |= MOD_TUNE;
+        break;
+      }
+      case 'X' : {
+        flags |= MOD_EVALUATE;
+        xlink_binary_add_configs(&bin, optarg);
+        break;
+      }
+      case 'W' : {
+        flags |= MOD_WEIGH;
+        bin.budget.probe_bits = atof(optarg);
+        break;
+      }
+      case 'Y' : {
+        flags |= MOD_MAX_MODELS;
+        bin.budget.models = atoi(optarg);
+        break;
+      }
       case 'd' : {
         flags |= MOD_DUMP;
         break;
@@ -2367,10 +3682,61 @@ int main(int argc, char *argv[]) {
    ("Specified -M --memory size %i must be even", bin.hash_table_memory));
   XLINK_ERROR(flags & MOD_ONE && !(flags & MOD_PACK),
    ("Specified -1 --one without -p --pack but only valid for packed binaries"));
+  XLINK_ERROR(flags & MOD_AUTO_ONE && !(flags & MOD_PACK),
+   ("Specified -a --auto-one without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_AUTO_ONE && flags & (MOD_ONE | MOD_TUNE),
+   ("Specified -a --auto-one with -1 --one or -t --tune"));
+  XLINK_ERROR(xlink_list_length(&bin.groups) > 0 && !(flags & MOD_PACK),
+   ("Specified -g --group without -p --pack command line option"));
+  XLINK_ERROR(xlink_list_length(&bin.groups) > 0 && flags & MOD_AUTO_ONE,
+   ("Specified -g --group with -a --auto-one"));
+  XLINK_ERROR(flags & MOD_ORDER && !(flags & MOD_PACK),
+   ("Specified -O --order without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_FOLD && !(flags & MOD_PACK),
+   ("Specified -F --fold without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_RUN && !(flags & MOD_PACK),
+   ("Specified -r --run without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_TIME && !(flags & MOD_PACK),
+   ("Specified -D --time without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_TAG && !(flags & MOD_PACK),
+   ("Specified -T --tag without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_SPEED && !(flags & MOD_PACK),
+   ("Specified -S --speed without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_HISTORY && !(flags & MOD_PACK || flags & MOD_CHECK),
+   ("Specified -H --history without -p --pack or -c --check option"));
+  XLINK_ERROR(flags & MOD_BUCKET && !(flags & MOD_HISTORY),
+   ("Specified -K --bucket without -H --history command line option"));
   XLINK_ERROR(flags & MOD_LOW && !(flags & MOD_PACK || flags & MOD_CHECK),
    ("Specified -L --low without -p --pack or -c --check command line option"));
   XLINK_ERROR(flags & MOD_CLAMP && !(flags & MOD_PACK || flags & MOD_CHECK),
    ("Specified -C --clamp without -p --pack or -c --check command line option"));
+  XLINK_ERROR(flags & MOD_PARANOID && !(flags & MOD_PACK || flags & MOD_CHECK),
+   ("Specified -P --paranoid without -p --pack or -c --check option"));
+  XLINK_ERROR(flags & MOD_EVALUATE && !(flags & MOD_PACK || flags & MOD_CHECK),
+   ("Specified -X --evaluate without -p --pack or -c --check option"));
+  XLINK_ERROR(flags & MOD_WEIGH && !(flags & MOD_PACK || flags & MOD_CHECK),
+   ("Specified -W --weigh without -p --pack or -c --check option"));
+  XLINK_ERROR(flags & MOD_WEIGH && bin.budget.probe_bits < 0,
+   ("Specified -W --weigh bits %g must not be negative",
+   bin.budget.probe_bits));
+  XLINK_ERROR(flags & MOD_MAX_MODELS &&
+   !(flags & MOD_PACK || flags & MOD_CHECK),
+   ("Specified -Y --max-models without -p --pack or -c --check option"));
+  XLINK_ERROR(flags & MOD_MAX_MODELS && bin.budget.models < 1,
+   ("Specified -Y --max-models count %i must be at least 1",
+   bin.budget.models));
+  XLINK_ERROR(flags & MOD_AUTO_MEMORY &&
+   !(flags & MOD_PACK || flags & MOD_CHECK),
+   ("Specified -A --auto-memory without -p --pack or -c --check option"));
+  XLINK_ERROR(flags & MOD_AUTO_MEMORY && bin.auto_memory < 0,
+   ("Specified -A --auto-memory bytes %i must not be negative",
+   bin.auto_memory));
+  /* -W --weigh charges the probes of the stub -S --speed selects */
+  bin.budget.passes = flags & MOD_SPEED ? 1 : 2;
+  XLINK_ERROR(flags & MOD_TUNE && !(flags & MOD_PACK),
+   ("Specified -t --tune without -p --pack command line option"));
+  XLINK_ERROR(flags & MOD_TUNE && flags & XLINK_TUNE_FLAGS,
+   ("Specified -t --tune with -1, -L or -C but these are chosen by tuning"));
   if (flags & MOD_CHECK) {
     xlink_list bytes;
     xlink_list models;
@@ -2381,7 +3747,7 @@ int main(int argc, char *argv[]) {
     }
     xlink_list_init(&models, sizeof(xlink_model), 0);
     /* Search for the best context to use for bytes */
-    xlink_model_search(&models, &bytes);
+    xlink_model_search(&models, &bytes, &bin.budget);
     if (xlink_list_length(&models) > 0) {
       xlink_context ctx;
       xlink_bitstream bs;
@@ -2391,24 +3757,53 @@ int main(int argc, char *argv[]) {
        xlink_list_length(&models));
       xlink_model_set_state(&models,
        xlink_model_compute_packed_weights(&models));
+      if (flags & MOD_EVALUATE) {
+        xlink_list *segment_models;
+        xlink_list *segment_bytes;
+        /* Evaluate bytes as a single segment */
+        segment_models = &models;
+        segment_bytes = &bytes;
+        xlink_evaluate(&bin.configs, &segment_models, &segment_bytes, 1);
+        xlink_print_configs(&bin.configs, 8 + xlink_list_length(&models),
+         xlink_list_length(&bytes));
+      }
       /* Create a context from models */
-      xlink_context_init(&ctx, &models, 0, flags & MOD_LOW, flags & MOD_CLAMP);
+      xlink_context_init(&ctx, &models, 0, xlink_flags_hash(flags),
+       flags & MOD_CLAMP);
       /* Create a bitstream for writing */
       xlink_bitstream_init(&bs);
       /* Encode bytes with the context and perfect hashing */
-      xlink_bitstream_from_context(&bs, &ctx, &bytes);
+      xlink_bitstream_from_context(&bs, &ctx, &bytes, flags & MOD_PARANOID);
       size = 8 + xlink_list_length(&models) + (bs.bits + 7)/8;
       printf("Perfect hashing: %i bits, %i bytes\n", bs.bits, (bs.bits + 7)/8);
       printf("Compressed size: %i bytes -> %2.3lf%% smaller\n", size,
        XLINK_RATIO(size, xlink_list_length(&bytes)));
+      if (flags & MOD_AUTO_MEMORY) {
+        xlink_list *segment_models;
+        xlink_list *segment_bytes;
+        segment_models = &models;
+        segment_bytes = &bytes;
+        bin.hash_table_memory = 2*xlink_auto_memory(&segment_models,
+         &segment_bytes, 1, xlink_flags_hash(flags), flags & MOD_CLAMP,
+         bin.auto_memory, bin.hash_table_memory/2);
+      }
       /* Encode bytes with the context and replacement hashing */
       printf("Using hash table size = %i\n", bin.hash_table_memory/2);
       xlink_context_set_fixed_capacity(&ctx, bin.hash_table_memory/2);
-      xlink_bitstream_from_context(&bs, &ctx, &bytes);
+      xlink_bitstream_from_context(&bs, &ctx, &bytes, flags & MOD_PARANOID);
       size = 8 + xlink_list_length(&models) + (bs.bits + 7)/8;
       printf("Replace hashing: %i bits, %i bytes\n", bs.bits, (bs.bits + 7)/8);
       printf("Compressed size: %i bytes -> %2.3lf%% smaller\n", size,
        XLINK_RATIO(size, xlink_list_length(&bytes)));
+      if (flags & MOD_BUCKET) {
+        xlink_list *segment_models;
+        xlink_list *segment_bytes;
+        segment_models = &models;
+        segment_bytes = &bytes;
+        xlink_print_unbucketed(&segment_models, &segment_bytes, 1,
+         bin.hash_table_memory/2, xlink_flags_hash(flags), flags & MOD_CLAMP,
+         bs.bits);
+      }
       xlink_context_clear(&ctx);
       xlink_bitstream_clear(&bs);
     }
@@ -2464,7 +3859,12 @@ int main(int argc, char *argv[]) {
     xlink_file_clear(&file);
   }
   if (!(flags & MOD_DUMP)) {
-    xlink_binary_link(&bin, flags);
+    if (flags & MOD_TUNE) {
+      xlink_binary_tune(&bin, flags);
+    }
+    else {
+      xlink_binary_link(&bin, flags);
+    }
   }
   xlink_binary_clear(&bin);
 }
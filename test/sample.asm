@@ -0,0 +1,97 @@
+; A small program that make check links with each packing stub, then unpacks
+;  in the x86 interpreter with -r --run
+
+CPU 386
+
+GLOBAL init_
+GLOBAL main_
+
+SEGMENT _INIT USE16 CLASS=CODE
+
+; The 16-bit initialization function the i stubs call, linked with --init
+init_:
+  ret
+
+SEGMENT _TEXT USE32 CLASS=CODE
+
+; Print the greeting, then the table of squares in hexadecimal
+main_:
+  mov esi, greeting
+  call print_string
+
+  mov ebx, squares
+  xor ecx, ecx
+.next_square:
+  mov al, [ebx + ecx]
+  call print_hex8
+  inc ecx
+
+  ; Separate the squares with spaces, 16 to a line
+  mov dl, ' '
+  test cl, 15
+  jnz .separator
+  mov dl, 10
+.separator:
+  call print_char
+
+  ; CH = 1 after the last square
+  test ch, 1
+  jz .next_square
+
+  mov ah, 0x4c
+  int 0x21
+
+; Print a $ terminated string
+;  ESI = pointer to string
+print_string:
+  lodsb
+  cmp al, '$'
+  je .done
+  mov dl, al
+  call print_char
+  jmp print_string
+.done:
+  ret
+
+; Print an 8-bit hexadecimal number
+;  AL = number
+print_hex8:
+  push eax
+  shr al, 4
+  call print_hex4
+  pop eax
+
+; Print a 4-bit hexadecimal number
+;  AL = number
+print_hex4:
+  push eax
+  and al, 15
+  add al, '0'
+  cmp al, '9'
+  jbe .digit
+  add al, 'a' - '9' - 1
+.digit:
+  mov dl, al
+  call print_char
+  pop eax
+  ret
+
+; Print a character using DOS INT 21h, subfunction 2h
+;  DL = character
+print_char:
+  push eax
+  mov ah, 2
+  int 0x21
+  pop eax
+  ret
+
+SEGMENT _DATA USE32 CLASS=DATA
+
+greeting: db 'Squares of 0 to 255, modulo 256:', 13, 10, '$'
+
+squares:
+%assign i 0
+%rep 256
+  db (i*i) & 0xff
+%assign i i+1
+%endrep